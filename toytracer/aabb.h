@@ -0,0 +1,94 @@
+#pragma once
+
+#include "toytracer.h"
+
+#include "ray_packet.h"
+
+class aabb {
+	public:
+		aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+		aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+		point3 min() const { return minimum; }
+		point3 max() const { return maximum; }
+
+		bool hit(const ray& r, real t_min, real t_max) const {
+			for (int a = 0; a < 3; a++) {
+				auto inv_d = 1 / r.direction()[a];
+				auto t0 = (minimum[a] - r.origin()[a]) * inv_d;
+				auto t1 = (maximum[a] - r.origin()[a]) * inv_d;
+				if (inv_d < 0)
+					std::swap(t0, t1);
+				t_min = t0 > t_min ? t0 : t_min;
+				t_max = t1 < t_max ? t1 : t_max;
+				if (t_max <= t_min)
+					return false;
+			}
+			return true;
+		}
+
+		// True if any lane of the packet overlaps the box within [t_min, t_max[lane]]
+		bool hit_packet(const ray_packet& packet, real t_min, const real t_max[packet_width]) const {
+			int any_hit = 0;
+			for (int lane = 0; lane < packet_width; lane++) {
+				const real tx0 = (minimum.x() - packet.ox[lane]) * packet.inv_dx[lane];
+				const real tx1 = (maximum.x() - packet.ox[lane]) * packet.inv_dx[lane];
+				const real ty0 = (minimum.y() - packet.oy[lane]) * packet.inv_dy[lane];
+				const real ty1 = (maximum.y() - packet.oy[lane]) * packet.inv_dy[lane];
+				const real tz0 = (minimum.z() - packet.oz[lane]) * packet.inv_dz[lane];
+				const real tz1 = (maximum.z() - packet.oz[lane]) * packet.inv_dz[lane];
+
+				// Plain compares rather than fmin/fmax, which lower to vector min/max instructions
+				const real near_x = tx0 < tx1 ? tx0 : tx1, far_x = tx0 < tx1 ? tx1 : tx0;
+				const real near_y = ty0 < ty1 ? ty0 : ty1, far_y = ty0 < ty1 ? ty1 : ty0;
+				const real near_z = tz0 < tz1 ? tz0 : tz1, far_z = tz0 < tz1 ? tz1 : tz0;
+				real t_near = near_x > near_y ? near_x : near_y;
+				t_near = t_near > near_z ? t_near : near_z;
+				t_near = t_near > t_min ? t_near : t_min;
+				real t_far = far_x < far_y ? far_x : far_y;
+				t_far = t_far < far_z ? t_far : far_z;
+				t_far = t_far < t_max[lane] ? t_far : t_max[lane];
+				any_hit |= t_near < t_far;
+			}
+			return any_hit != 0;
+		}
+
+		void expand(const point3& p) {
+			minimum = point3(fmin(minimum.x(), p.x()), fmin(minimum.y(), p.y()), fmin(minimum.z(), p.z()));
+			maximum = point3(fmax(maximum.x(), p.x()), fmax(maximum.y(), p.y()), fmax(maximum.z(), p.z()));
+		}
+
+		void expand(const aabb& box) {
+			expand(box.minimum);
+			expand(box.maximum);
+		}
+
+		point3 centroid() const {
+			return real(0.5) * (minimum + maximum);
+		}
+
+		real surface_area() const {
+			// Empty boxes (min > max) contribute nothing to the SAH cost
+			if (maximum.x() < minimum.x())
+				return 0;
+			auto d = maximum - minimum;
+			return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+		}
+
+		int longest_axis() const {
+			auto d = maximum - minimum;
+			if (d.x() > d.y() && d.x() > d.z())
+				return 0;
+			return d.y() > d.z() ? 1 : 2;
+		}
+
+	public:
+		point3 minimum;
+		point3 maximum;
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+	aabb box = box0;
+	box.expand(box1);
+	return box;
+}
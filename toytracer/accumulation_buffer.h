@@ -0,0 +1,518 @@
+#pragma once
+
+#include "toytracer.h"
+
+#include "camera.h"
+#include "color.h"
+#include "denoiser.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
+#include "tonemap.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// What a sample's primary ray hit. The position drives reprojection; the albedo and normal guide the
+// denoiser. A ray that missed the scene has an infinite position, a zero normal and the sky as albedo.
+struct first_hit {
+	point3 position;
+	vec3 normal;
+	color albedo;
+};
+
+// Reprojected history is dropped where the new first hit is further from the old one than this
+// fraction of its distance to the camera
+const real disocclusion_tolerance = real(0.02);
+
+// Full resolution passes before a tile's error estimate is trusted
+const uint32_t min_error_samples = 16;
+
+// Pacing of the interactive denoiser: at least this many seconds between the starts of two runs, and
+// no more than this share of one thread's time spent filtering
+const double denoise_min_interval = 0.1;
+const double denoise_max_share = 0.25;
+
+// Progressive per-tile float accumulation, kept apart from the displayed 8-bit image. Each tile's
+// sums are stored contiguously. The worker owning a tile adds whole passes to it without locking,
+// under a per-tile sequence counter (a seqlock). The display thread then resolves only the tiles
+// that gained samples, copying each under the sequence check so it never shows a half-added pass.
+//
+// After a reset, tiles can start with block previews: a pass with one sample per block of pixels,
+// the block halving with each pass until it reaches one pixel. A preview pass replaces the tile's
+// contents instead of adding to them, and so does the first full resolution pass that follows.
+//
+// A camera move need not throw the samples away. reproject moves each pixel's mean to where its
+// first hit lands in the new view, as history worth a clamped number of samples. The first full
+// resolution pass over a tile keeps the history of pixels whose new first hit is close to the
+// reprojected one, and drops it where the surface behind was disoccluded.
+//
+// Each pixel also keeps the luminance moments of its full resolution samples. From them every pass
+// updates an error estimate for the tile, which lets the renderer stop spending samples on tiles
+// that have converged. With a denoiser set, resolve hands it the means of the changed tiles, along
+// with each pixel's mean first hit albedo and normal, and filters the frame in the background, paced
+// so it takes a bounded share of the workers. Until a filtered frame of the current image is ready,
+// as after every camera move, tiles are displayed unfiltered.
+class accumulation_buffer {
+	public:
+		accumulation_buffer(int width, int height)
+			: width(width), height(height), sums(size_t(width) * height * 3),
+			  positions(size_t(width) * height * 3), history_weights(size_t(width) * height),
+			  luminance_moments(size_t(width) * height * 2), guides(size_t(width) * height * 6),
+			  previous_sums(sums.size()), previous_positions(positions.size()), previous_weights(history_weights.size()),
+			  previous_guides(guides.size()), reprojection_targets(new std::atomic<uint64_t>[size_t(width) * height]) {}
+
+		// Lays the tile buffers out for the scheduler's current tiles and clears them. Each tile starts
+		// with previews at preview_block_size (a power of two; 1 for none). Only safe while no worker
+		// is adding passes.
+		void reset(const tile_scheduler& tiles, int preview_block_size = 1);
+
+		// Resets for a new camera, carrying the accumulated image over into its view as history of at
+		// most max_history samples per pixel. The work is spread over pool by tile. Only safe while no
+		// worker is adding passes.
+		void reproject(const camera& cam, const tile_scheduler& tiles, thread_pool& pool, int preview_block_size, float max_history);
+
+		// Full resolution passes accumulated in a tile, which is also the sample index of every pixel
+		// in its next full resolution pass. Only the worker owning the tile may call this.
+		uint32_t sample_count(size_t tile_index) const {
+			const auto& info = tile_info[tile_index];
+			return info.preview ? 0 : info.sample_count;
+		}
+
+		// Side of the pixel blocks the tile's next pass should cover with one sample each; 1 once the
+		// tile is at full resolution. Only the worker owning the tile may call this.
+		int block_size(size_t tile_index) const { return tile_info[tile_index].block_size; }
+
+		// Adds a pass with one sample per tile pixel, given row by row; a preview pass has each sample
+		// repeated over its block, along with what its primary ray hit. Only the worker owning the tile
+		// may call this.
+		void add_pass(size_t tile_index, const color samples[], const first_hit first_hits[]);
+
+		// Estimated error of the noisiest pixel in a tile: the standard error of its mean luminance,
+		// carried through the display gamma so it is roughly in display units (1/255 is one 8-bit step).
+		// Infinite until the tile has min_error_samples full resolution passes. Any thread may call this.
+		float error(size_t tile_index) const { return tile_errors[tile_index].load(std::memory_order_relaxed); }
+
+		// Makes resolve draw each tile's sample count as a heat map instead of the image
+		void show_sample_density(bool enabled) {
+			density_view = enabled;
+			mark_unresolved();
+		}
+
+		// Routes resolve through filter, or straight to the display for null. The denoiser must be sized
+		// for the frame, and must outlive its last background run.
+		void set_denoiser(denoiser* filter) {
+			denoise = filter;
+			denoised_current = false;
+			mark_unfed();
+			mark_unresolved();
+		}
+
+		// Tonemaps and quantizes every tile with new samples into pixels (ABGR8888, full frame). Tiles
+		// being written right now are left for the next call. The rects that changed are returned in
+		// resolved_tiles, so only they need uploading; a finished filter run updates the whole frame.
+		void resolve(std::vector<uint8_t>& pixels, const tonemap_settings& settings, std::vector<tile_scheduler::tile>& resolved_tiles);
+
+		// Makes the next resolve redo every tile, e.g. after the tonemap settings changed
+		void mark_unresolved();
+
+	private:
+		struct tile_state {
+			tile_scheduler::tile rect;
+			size_t offset;               // First pixel of the tile in the tile ordered buffers
+			uint32_t sample_count;       // Passes in the sums; written by the owning worker inside the sequence
+			int block_size;              // Block side of the next pass; owning worker only
+			bool preview;                // Sums hold a preview the next pass replaces; owning worker only
+			bool history;                // Some pixels hold reprojected samples, so weights vary per pixel
+			bool fed;                    // The denoiser holds this tile of the current image; display thread only
+			uint32_t resolved_sequence;  // Sequence value last resolved; display thread only
+		};
+
+		int width;
+		int height;
+		std::vector<float> sums;
+		std::vector<float> positions;        // First hit of each pixel's first full resolution sample
+		std::vector<float> history_weights;  // Samples of reprojected history in each pixel's sum
+		std::vector<float> luminance_moments; // Sum of luminance and of its square over the full resolution passes
+		std::vector<float> guides;           // Mean first hit albedo and normal of each pixel
+		point3 history_origin;               // Camera position the history was reprojected for
+		std::vector<tile_state> tile_info;
+		std::unique_ptr<std::atomic<uint32_t>[]> sequence; // Odd while a pass is being added
+		std::unique_ptr<std::atomic<float>[]> tile_errors;
+		bool density_view = false;
+		denoiser* denoise = nullptr;
+		uint32_t image_generation = 0;  // Moved on by every reset
+		uint32_t filter_generation = 0; // image_generation when the last filter run started
+		bool denoised_current = false;  // pixels hold a filter result for the current image
+		bool filter_pending = false;    // Denoiser inputs changed since the last run started
+		size_t unfed_tiles = 0;         // Tiles of the current image not handed to the denoiser yet
+		std::chrono::steady_clock::time_point next_filter; // Earliest start of the next run
+		// The previous image while reprojecting, swapped with the live buffers so neither is reallocated
+		std::vector<float> previous_sums;
+		std::vector<float> previous_positions;
+		std::vector<float> previous_weights; // Total samples in each old pixel, 0 where it has nothing to carry
+		std::vector<float> previous_guides;
+		// Old pixel landing on each new one in frame order, below its squared distance to the new camera
+		// in the high bits so the nearest surface wins an atomic min; all ones for none
+		std::unique_ptr<std::atomic<uint64_t>[]> reprojection_targets;
+		std::vector<float> resolve_means;
+		std::vector<float> resolve_guides;
+		std::vector<float> denoised;
+		std::vector<uint8_t> resolve_scratch;
+
+		void update_error(size_t tile_index);
+		void mark_unfed();
+};
+
+void accumulation_buffer::reset(const tile_scheduler& tiles, int preview_block_size) {
+	tile_info.resize(tiles.tile_count());
+	sequence.reset(new std::atomic<uint32_t>[tiles.tile_count()]);
+	tile_errors.reset(new std::atomic<float>[tiles.tile_count()]);
+
+	size_t offset = 0;
+	for (size_t i = 0; i < tiles.tile_count(); i++) {
+		auto& info = tile_info[i];
+		info.rect = tiles.get_tile(i);
+		info.offset = offset;
+		info.sample_count = 0;
+		info.block_size = preview_block_size;
+		info.preview = false;
+		info.history = false;
+		info.resolved_sequence = 0;
+		sequence[i].store(0, std::memory_order_relaxed);
+		tile_errors[i].store(std::numeric_limits<float>::infinity(), std::memory_order_relaxed);
+		offset += size_t(info.rect.pixel_count());
+	}
+
+	std::fill(sums.begin(), sums.end(), 0.0f);
+	std::fill(history_weights.begin(), history_weights.end(), 0.0f);
+
+	// A filter run still going is for the old image, and its result will be dropped. The denoiser's
+	// inputs still hold the old image too, so no run starts until every tile has replaced its part.
+	image_generation++;
+	denoised_current = false;
+	mark_unfed();
+	if (denoise)
+		denoise->cancel();
+}
+
+void accumulation_buffer::reproject(const camera& cam, const tile_scheduler& tiles, thread_pool& pool, int preview_block_size, float max_history) {
+	const point3 origin = cam.get_origin();
+	const size_t frame_pixels = size_t(width) * height;
+	const uint64_t no_source = ~uint64_t(0);
+
+	// The old image moves to the scratch buffers, and reset clears the live ones for the new layout
+	sums.swap(previous_sums);
+	positions.swap(previous_positions);
+	history_weights.swap(previous_weights);
+	guides.swap(previous_guides);
+
+	const size_t rows_per_job = 16;
+	pool.parallel_for((height + rows_per_job - 1) / rows_per_job, [&](size_t job) {
+		const size_t begin = job * rows_per_job * width;
+		const size_t end = std::min(frame_pixels, begin + rows_per_job * width);
+		for (size_t i = begin; i < end; i++)
+			reprojection_targets[i].store(no_source, std::memory_order_relaxed);
+	});
+
+	// Project every old pixel's first hit into the new view. Pixels only covered by a preview have no
+	// position and are left out.
+	pool.parallel_for(tile_info.size(), [&](size_t tile_index) {
+		const auto& info = tile_info[tile_index];
+		const float passes = info.preview ? 0.0f : float(info.sample_count);
+		for (int i = 0; i < info.rect.pixel_count(); i++) {
+			const size_t pixel = info.offset + i;
+			const float history = previous_weights[pixel];
+			const float weight = history > 0 ? history + passes : passes;
+			const float* p = &previous_positions[pixel * 3];
+			previous_weights[pixel] = 0.0f;
+			if (weight <= 0 || !std::isfinite(p[0]))
+				continue;
+
+			const point3 position(p[0], p[1], p[2]);
+			real u, v;
+			if (!cam.project(position, u, v))
+				continue;
+			const int x = static_cast<int>(std::floor(u * (width - 1)));
+			const int y = (height - 1) - static_cast<int>(std::floor(v * (height - 1)));
+			if (x < 0 || x >= width || y < 0 || y >= height)
+				continue;
+
+			// Non-negative floats order the same as their bits
+			const float depth = float((position - origin).length_squared());
+			uint32_t depth_bits;
+			std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+			const uint64_t candidate = uint64_t(depth_bits) << 32 | uint32_t(pixel);
+			auto& target = reprojection_targets[size_t(y) * width + x];
+			uint64_t current = target.load(std::memory_order_relaxed);
+			while (candidate < current && !target.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {}
+			previous_weights[pixel] = weight;
+		}
+	});
+
+	reset(tiles, preview_block_size);
+	history_origin = origin;
+
+	// Each new tile gathers the old pixels that landed on it
+	pool.parallel_for(tile_info.size(), [&](size_t tile_index) {
+		auto& info = tile_info[tile_index];
+		const auto& t = info.rect;
+		for (int y = t.y0; y < t.y1; y++) {
+			for (int x = t.x0; x < t.x1; x++) {
+				const uint64_t target = reprojection_targets[size_t(y) * width + x].load(std::memory_order_relaxed);
+				if (target == no_source)
+					continue;
+
+				const size_t source = uint32_t(target);
+				const float weight = previous_weights[source];
+				const float history = std::min(weight, max_history);
+				const size_t pixel = info.offset + (x - t.x0) + size_t(y - t.y0) * t.width();
+				for (int c = 0; c < 3; c++) {
+					sums[pixel * 3 + c] = previous_sums[source * 3 + c] / weight * history;
+					positions[pixel * 3 + c] = previous_positions[source * 3 + c];
+				}
+				std::copy(&previous_guides[source * 6], &previous_guides[source * 6] + 6, &guides[pixel * 6]);
+				history_weights[pixel] = history;
+				info.history = true;
+			}
+		}
+
+		// Show the history right away rather than waiting for the tile's first pass
+		if (info.history)
+			info.resolved_sequence = 1;
+	});
+}
+
+void accumulation_buffer::add_pass(size_t tile_index, const color samples[], const first_hit first_hits[]) {
+	auto& info = tile_info[tile_index];
+	auto& seq = sequence[tile_index];
+	const uint32_t s = seq.load(std::memory_order_relaxed);
+
+	seq.store(s + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	float* tile_sums = &sums[info.offset * 3];
+	float* tile_positions = &positions[info.offset * 3];
+	float* tile_history = &history_weights[info.offset];
+	float* tile_moments = &luminance_moments[info.offset * 2];
+	float* tile_guides = &guides[info.offset * 6];
+	const int pixel_count = info.rect.pixel_count();
+
+	// Guides are kept as running means over the same samples as the sums
+	auto set_guide = [&](int i, float keep) {
+		const first_hit& hit = first_hits[i];
+		const float values[6] = { float(hit.albedo.x()), float(hit.albedo.y()), float(hit.albedo.z()),
+		                          float(hit.normal.x()), float(hit.normal.y()), float(hit.normal.z()) };
+		for (int c = 0; c < 6; c++)
+			tile_guides[i * 6 + c] = keep * tile_guides[i * 6 + c] + (1 - keep) * values[c];
+	};
+
+	if (info.block_size > 1) {
+		// Previews replace what the tile held, apart from pixels showing history
+		for (int i = 0; i < pixel_count; i++) {
+			if (tile_history[i] > 0)
+				continue;
+			tile_sums[i * 3 + 0] = float(samples[i].x());
+			tile_sums[i * 3 + 1] = float(samples[i].y());
+			tile_sums[i * 3 + 2] = float(samples[i].z());
+			set_guide(i, 0.0f);
+		}
+		info.sample_count = 1;
+		info.preview = true;
+		info.block_size /= 2;
+	} else if (info.preview || info.sample_count == 0) {
+		// The first full resolution pass replaces any preview, and keeps a pixel's history only if its
+		// new first hit lands near the reprojected one
+		for (int i = 0; i < pixel_count; i++) {
+			const point3& p = first_hits[i].position;
+			bool keep_history = false;
+			if (tile_history[i] > 0) {
+				const point3 previous(tile_positions[i * 3 + 0], tile_positions[i * 3 + 1], tile_positions[i * 3 + 2]);
+				const real tolerance = disocclusion_tolerance * (p - history_origin).length();
+				keep_history = (p - previous).length_squared() < tolerance * tolerance;
+			}
+
+			if (keep_history) {
+				tile_sums[i * 3 + 0] += float(samples[i].x());
+				tile_sums[i * 3 + 1] += float(samples[i].y());
+				tile_sums[i * 3 + 2] += float(samples[i].z());
+				set_guide(i, tile_history[i] / (tile_history[i] + 1));
+			} else {
+				tile_sums[i * 3 + 0] = float(samples[i].x());
+				tile_sums[i * 3 + 1] = float(samples[i].y());
+				tile_sums[i * 3 + 2] = float(samples[i].z());
+				tile_history[i] = 0.0f;
+				set_guide(i, 0.0f);
+			}
+			tile_positions[i * 3 + 0] = float(p.x());
+			tile_positions[i * 3 + 1] = float(p.y());
+			tile_positions[i * 3 + 2] = float(p.z());
+
+			const float l = float(luminance(samples[i]));
+			tile_moments[i * 2 + 0] = l;
+			tile_moments[i * 2 + 1] = l * l;
+		}
+		info.sample_count = 1;
+		info.preview = false;
+	} else {
+		const float passes = float(info.sample_count);
+		for (int i = 0; i < pixel_count; i++) {
+			tile_sums[i * 3 + 0] += float(samples[i].x());
+			tile_sums[i * 3 + 1] += float(samples[i].y());
+			tile_sums[i * 3 + 2] += float(samples[i].z());
+			const float weight = tile_history[i] + passes;
+			set_guide(i, weight / (weight + 1));
+
+			const float l = float(luminance(samples[i]));
+			tile_moments[i * 2 + 0] += l;
+			tile_moments[i * 2 + 1] += l * l;
+		}
+		info.sample_count++;
+	}
+
+	seq.store(s + 2, std::memory_order_release);
+
+	if (!info.preview)
+		update_error(tile_index);
+}
+
+void accumulation_buffer::update_error(size_t tile_index) {
+	const auto& info = tile_info[tile_index];
+	const uint32_t n = info.sample_count;
+	if (n < min_error_samples)
+		return;
+
+	// The display shows roughly sqrt(mean), so an error e in the mean shows as e / (2 sqrt(mean))
+	const float* tile_moments = &luminance_moments[info.offset * 2];
+	float worst = 0.0f;
+	for (int i = 0; i < info.rect.pixel_count(); i++) {
+		const float mean = tile_moments[i * 2 + 0] / n;
+		const float variance = std::max(0.0f, tile_moments[i * 2 + 1] / n - mean * mean) * n / (n - 1);
+		const float error = std::sqrt(variance / n) / (2.0f * std::sqrt(std::max(mean, 1e-4f)));
+		worst = std::max(worst, error);
+	}
+	tile_errors[tile_index].store(worst, std::memory_order_relaxed);
+}
+
+void accumulation_buffer::resolve(std::vector<uint8_t>& pixels, const tonemap_settings& settings, std::vector<tile_scheduler::tile>& resolved_tiles) {
+	resolved_tiles.clear();
+	const bool denoising = denoise != nullptr && !density_view;
+
+	// A background run owns the denoiser's inputs until it finishes. A finished run replaces the whole
+	// frame, unless it started before the last reset.
+	bool feed_denoiser = false;
+	if (denoising && !denoise->busy()) {
+		if (denoise->finish() && filter_generation == image_generation) {
+			tonemap_rgba(settings, 1.0f, denoised.data(), pixels.data(), size_t(width) * height);
+			resolved_tiles.push_back({ 0, 0, width, height });
+			denoised_current = true;
+		}
+		feed_denoiser = true;
+	}
+
+	// Tiles are shown unfiltered until the filter has caught up with the current image. Tiles the busy
+	// filter can't take yet are left unresolved, so they are handed over once it finishes.
+	const bool show_tiles = !denoising || !denoised_current;
+	if (!show_tiles && !feed_denoiser)
+		return;
+
+	for (size_t tile_index = 0; tile_index < tile_info.size(); tile_index++) {
+		auto& info = tile_info[tile_index];
+		auto& seq = sequence[tile_index];
+
+		// Every pass moves the sequence on, so an unchanged value means nothing new to show
+		const uint32_t before = seq.load(std::memory_order_acquire);
+		if ((before & 1) || before == info.resolved_sequence)
+			continue;
+		const uint32_t count = info.sample_count;
+		if (count == 0 && !info.history)
+			continue;
+
+		// Tonemap (or for the denoiser, copy) into scratch, then check no pass was added meanwhile; if
+		// one was, try again next frame
+		const auto& t = info.rect;
+		const int pixel_count = t.pixel_count();
+		const float* tile_sums = &sums[info.offset * 3];
+		resolve_scratch.resize(size_t(pixel_count) * 4);
+		if (density_view) {
+			// Blue for a single pass up to red at 1024 and more
+			const float heat = std::min(1.0f, std::log2(float(std::max(count, 1u))) / 10.0f);
+			const uint8_t rgba[4] = { uint8_t(255 * heat), uint8_t(64), uint8_t(255 * (1 - heat)), 255 };
+			for (int i = 0; i < pixel_count; i++)
+				std::copy(rgba, rgba + 4, &resolve_scratch[size_t(i) * 4]);
+		} else if (!info.history && !denoising) {
+			tonemap_rgba(settings, 1.0f / float(count), tile_sums, resolve_scratch.data(), pixel_count);
+		} else {
+			// Pixels with history hold more samples than the tile's passes, so the means are taken first
+			const float passes = info.preview ? 0.0f : float(count);
+			resolve_means.resize(size_t(pixel_count) * 3);
+			for (int i = 0; i < pixel_count; i++) {
+				const float history = history_weights[info.offset + i];
+				const float weight = history > 0 ? history + passes : float(count);
+				const float scale = weight > 0 ? 1.0f / weight : 0.0f;
+				for (int c = 0; c < 3; c++)
+					resolve_means[i * 3 + c] = tile_sums[i * 3 + c] * scale;
+			}
+
+			if (feed_denoiser)
+				resolve_guides.assign(&guides[info.offset * 6], &guides[(info.offset + pixel_count) * 6]);
+			if (show_tiles)
+				tonemap_rgba(settings, 1.0f, resolve_means.data(), resolve_scratch.data(), pixel_count);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (seq.load(std::memory_order_relaxed) != before)
+			continue;
+
+		if (!denoising || feed_denoiser)
+			info.resolved_sequence = before;
+		if (feed_denoiser) {
+			for (int i = 0; i < pixel_count; i++) {
+				const size_t pixel = size_t(t.y0 + i / t.width()) * width + t.x0 + i % t.width();
+				denoise->set_pixel(pixel, &resolve_means[i * 3], &resolve_guides[i * 6], &resolve_guides[i * 6 + 3]);
+			}
+			if (!info.fed) {
+				info.fed = true;
+				unfed_tiles--;
+			}
+			filter_pending = true;
+		}
+		if (!show_tiles)
+			continue;
+
+		for (int y = t.y0; y < t.y1; y++) {
+			const uint8_t* row = &resolve_scratch[size_t(y - t.y0) * t.width() * 4];
+			std::copy(row, row + t.width() * 4, &pixels[(size_t(width) * y + t.x0) * 4]);
+		}
+		resolved_tiles.push_back(t);
+	}
+
+	// The filter reaches across tiles, so a change anywhere refilters the whole frame, though not before
+	// every tile has some of the current image. Runs are paced by their own cost, so a large frame on
+	// few threads is filtered less often rather than taking over the workers.
+	const auto now = std::chrono::steady_clock::now();
+	if (feed_denoiser && filter_pending && unfed_tiles == 0 && now >= next_filter) {
+		denoised.resize(size_t(width) * height * 3);
+		filter_generation = image_generation;
+		filter_pending = false;
+		denoise->start(denoised.data());
+		const double interval = std::max(denoise_min_interval, denoise->last_seconds() / denoise_max_share);
+		next_filter = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval));
+	}
+}
+
+void accumulation_buffer::mark_unfed() {
+	for (auto& info : tile_info)
+		info.fed = false;
+	unfed_tiles = tile_info.size();
+}
+
+void accumulation_buffer::mark_unresolved() {
+	// Sequence values seen by resolve are always even, so an odd one never matches
+	for (auto& info : tile_info)
+		info.resolved_sequence = 1;
+}
@@ -0,0 +1,381 @@
+#pragma once
+
+#include "toytracer.h"
+
+#include "camera.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "ray_packet.h"
+#include "sphere.h"
+#include "tagged_scene.h"
+#include "tonemap.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Microbenchmarks selected with --bench <name>. Each prints its own throughput numbers.
+
+template <typename F>
+double time_seconds(F&& f) {
+	auto start = std::chrono::steady_clock::now();
+	f();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+void print_throughput(const char* label, double seconds, double operations, uint64_t hits) {
+	std::cout << "  " << label << ": " << (operations / seconds) / 1e6 << " M tests/s ("
+	          << (seconds * 1e9) / operations << " ns/test, " << hits << " hits)" << std::endl;
+}
+
+// The vec3 backend is fixed at compile time, so scalar and SIMD are compared by running this in a
+// build with TOYTRACER_SIMD_VEC3 and one without
+int benchmark_sphere_hit() {
+	const int sphere_count = 64;
+	const int ray_count = 1 << 18;
+	const int repeats = 4;
+
+	seed_random(1, 1);
+	std::vector<sphere> spheres;
+	for (int i = 0; i < sphere_count; i++)
+		spheres.push_back(sphere(vec3::random(-10, 10), random_double(0.2, 2.0)));
+
+	std::vector<ray> rays;
+	for (int i = 0; i < ray_count; i++)
+		rays.push_back(ray(vec3::random(-12, 12), random_unit_vector()));
+
+	const double tests = double(sphere_count) * ray_count * repeats;
+	std::cout << "sphere::hit, " << sphere_count << " spheres x " << ray_count << " rays x " << repeats << " repeats" << std::endl;
+
+	uint64_t vec3_hits = 0;
+	double vec3_seconds = time_seconds([&] {
+		hit_result result;
+		for (int rep = 0; rep < repeats; rep++) {
+			for (const auto& r : rays) {
+				for (const auto& s : spheres) {
+					if (s.sphere::hit(r, 0.001, infinity, result))
+						vec3_hits++;
+				}
+			}
+		}
+	});
+	print_throughput("sphere::hit (" TOYTRACER_VEC3_BACKEND " vec3)", vec3_seconds, tests, vec3_hits);
+
+	return 0;
+}
+
+int benchmark_primary_packets(const hittable& world, const camera& cam, int width, int height) {
+	// Primary visibility only: one unjittered ray per pixel, traced singly and then as packets
+	const int repeats = 4;
+	const double rays = double(width) * height * repeats;
+	std::cout << "Primary visibility, " << width << "x" << height << " x " << repeats << " repeats, "
+	          << packet_width << "-wide packets" << std::endl;
+
+	auto pixel_ray = [&](int x, int y) {
+		return cam.get_ray(real(x) / (width - 1), real((height - 1) - y) / (height - 1));
+	};
+
+	uint64_t single_hits = 0;
+	double single_seconds = time_seconds([&] {
+		hit_result result;
+		for (int rep = 0; rep < repeats; rep++)
+			for (int y = 0; y < height; y++)
+				for (int x = 0; x < width; x++)
+					single_hits += world.hit(pixel_ray(x, y), self_intersection_epsilon, infinity, result);
+	});
+
+	uint64_t packet_hits = 0;
+	double packet_seconds = time_seconds([&] {
+		ray_packet packet;
+		packet_hit hits;
+		for (int rep = 0; rep < repeats; rep++) {
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x += packet_width) {
+					packet.lane_count = std::min(packet_width, width - x);
+					for (int lane = 0; lane < packet.lane_count; lane++)
+						packet.set_lane(lane, pixel_ray(x + lane, y));
+					packet.pad();
+
+					hits.reset(packet, infinity);
+					world.hit_packet(packet, self_intersection_epsilon, hits);
+					for (int lane = 0; lane < packet.lane_count; lane++)
+						packet_hits += hits.hit(lane);
+				}
+			}
+		}
+	});
+
+	std::cout << "  single rays: " << (rays / single_seconds) / 1e6 << " M rays/s (" << single_hits << " hits)" << std::endl;
+	std::cout << "  packets:     " << (rays / packet_seconds) / 1e6 << " M rays/s (" << packet_hits << " hits)" << std::endl;
+	return 0;
+}
+
+// Follows one path of up to max_depth bounces. Hit and Scatter wrap one scene representation.
+template <typename Hit, typename Scatter>
+color benchmark_path(ray r, int max_depth, Hit&& hit, Scatter&& scatter) {
+	color throughput(1, 1, 1);
+	for (int depth = 0; depth < max_depth; depth++) {
+		hit_result result;
+		if (!hit(r, result))
+			return throughput * color(1, 1, 1);
+
+		color attenuation;
+		ray scattered;
+		if (!scatter(r, result, attenuation, scattered))
+			return color(0, 0, 0);
+
+		throughput = throughput * attenuation;
+		r = scattered;
+	}
+	return color(0, 0, 0);
+}
+
+int benchmark_dispatch() {
+	// The same random scene as virtual hittables/materials and as a tagged scene, traced with the same
+	// seeds. Both are flat lists so the difference comes down to the dispatch.
+	const int sphere_count = 64;
+	const int path_count = 1 << 17;
+	const int max_depth = 8;
+
+	seed_random(2, 0);
+	hittable_list virtual_scene;
+	tagged_scene flat_scene;
+
+	auto add_sphere = [&](point3 center, real radius, bool is_metal, color albedo, real roughness) {
+		shared_ptr<material> m;
+		tagged_material tm;
+		if (is_metal) {
+			m = make_shared<metal>(albedo, roughness);
+			tm = tagged_material::make_metal(albedo, roughness);
+		} else {
+			m = make_shared<lambertian>(albedo);
+			tm = tagged_material::make_lambertian(albedo);
+		}
+		virtual_scene.add(make_shared<sphere>(center, radius, m));
+		flat_scene.add(tagged_primitive::make_sphere(center, radius, flat_scene.add_material(tm)));
+	};
+
+	add_sphere(point3(0, -1000, 0), 1000, false, color(0.5, 0.5, 0.5), 0);
+	for (int i = 0; i < sphere_count - 1; i++) {
+		const real radius = real(random_double(0.2, 1.0));
+		const point3 center(real(random_double(-8, 8)), radius, real(random_double(-8, 8)));
+		const bool is_metal = random_double() < 0.3;
+		add_sphere(center, radius, is_metal, color::random(0.2, 0.9), real(random_double(0, 0.5)));
+	}
+
+	sampler path_sampler;
+	auto camera_ray = [&path_sampler](int i) {
+		path_sampler.start(i, 0, 0);
+		return ray(point3(0, 3, -12), vec3(real(path_sampler.get_1d() * 1.2 - 0.6), real(path_sampler.get_1d() * 0.6 - 0.5), 1));
+	};
+
+	std::cout << "Path tracing, " << sphere_count << " spheres x " << path_count << " paths, up to "
+	          << max_depth << " bounces" << std::endl;
+
+	color virtual_sum(0, 0, 0);
+	double virtual_seconds = time_seconds([&] {
+		auto hit = [&](const ray& r, hit_result& result) {
+			return virtual_scene.hit(r, self_intersection_epsilon, infinity, result);
+		};
+		auto scatter = [&](const ray& r, const hit_result& result, color& attenuation, ray& scattered) {
+			return result.mat_ptr->scatter(r, result, path_sampler, attenuation, scattered);
+		};
+		for (int i = 0; i < path_count; i++)
+			virtual_sum += benchmark_path(camera_ray(i), max_depth, hit, scatter);
+	});
+
+	color tagged_sum(0, 0, 0);
+	double tagged_seconds = time_seconds([&] {
+		uint32_t material_id = 0;
+		auto hit = [&](const ray& r, hit_result& result) {
+			return flat_scene.hit(r, self_intersection_epsilon, infinity, result, material_id);
+		};
+		auto scatter = [&](const ray& r, const hit_result& result, color& attenuation, ray& scattered) {
+			return flat_scene.materials[material_id].scatter(r, result, path_sampler, attenuation, scattered);
+		};
+		for (int i = 0; i < path_count; i++)
+			tagged_sum += benchmark_path(camera_ray(i), max_depth, hit, scatter);
+	});
+
+	std::cout << "  virtual dispatch: " << (path_count / virtual_seconds) / 1e6 << " M paths/s (mean " << virtual_sum / real(path_count) << ")" << std::endl;
+	std::cout << "  tagged dispatch:  " << (path_count / tagged_seconds) / 1e6 << " M paths/s (mean " << tagged_sum / real(path_count) << ")" << std::endl;
+	return 0;
+}
+
+int benchmark_resolve(int width, int height) {
+	// One full frame of accumulated sums through the display transform, as the interactive resolve does it
+	const int repeats = 20;
+	const size_t pixel_count = size_t(width) * height;
+	const float sample_count = 16;
+
+	seed_random(3, 0);
+	std::vector<float> sums(pixel_count * 3);
+	for (auto& s : sums)
+		s = float(random_double(0, 1.5)) * sample_count;
+	std::vector<uint8_t> rgba(pixel_count * 4);
+
+	std::cout << "Resolve, " << width << "x" << height << " x " << repeats << " repeats" << std::endl;
+
+	// The per-sample conversion the interactive view did before: double precision sqrt per channel
+	double reference_seconds = time_seconds([&] {
+		const double scale = 1.0 / sample_count;
+		for (int rep = 0; rep < repeats; rep++) {
+			for (size_t i = 0; i < pixel_count; i++) {
+				for (int c = 0; c < 3; c++) {
+					const double v = sums[i * 3 + c] * scale;
+					rgba[i * 4 + c] = static_cast<uint8_t>(255.999 * sqrt(v < 1.0 ? v : 1.0));
+				}
+				rgba[i * 4 + 3] = 255;
+			}
+		}
+	});
+	std::cout << "  scalar double sqrt: " << reference_seconds * 1e3 / repeats << " ms/frame" << std::endl;
+
+	for (auto op : { tonemap_operator::clamp, tonemap_operator::reinhard, tonemap_operator::aces }) {
+		tonemap_settings settings;
+		settings.op = op;
+
+		double seconds = time_seconds([&] {
+			for (int rep = 0; rep < repeats; rep++)
+				tonemap_rgba(settings, 1.0f / sample_count, sums.data(), rgba.data(), pixel_count);
+		});
+
+		// Largest difference from the scalar reference of the same operator
+		int max_error = 0;
+		for (size_t i = 0; i < sums.size(); i++) {
+			const int expected = tonemap_byte(op, sums[i] / sample_count);
+			max_error = std::max(max_error, std::abs(expected - int(rgba[i / 3 * 4 + i % 3])));
+		}
+		std::cout << "  " << tonemap_name(op) << ": " << seconds * 1e3 / repeats << " ms/frame (max error "
+		          << max_error << " vs scalar)" << std::endl;
+	}
+	return 0;
+}
+
+int benchmark_rng() {
+	// Raw draws from each generator random_double() can be built on
+	const int draw_count = 1 << 24;
+	std::cout << "Random numbers, " << draw_count << " draws" << std::endl;
+
+	auto run = [draw_count](const char* label, auto rng) {
+		rng.seed(1, 1);
+		double sum = 0;
+		const double seconds = time_seconds([&] {
+			for (int i = 0; i < draw_count; i++)
+				sum += rng.next_double();
+		});
+		// The mean should be near 0.5; printing it also keeps the loop
+		std::cout << "  " << label << ": " << (seconds * 1e9) / draw_count << " ns/draw (mean " << sum / draw_count << ")" << std::endl;
+	};
+
+	run("pcg32      ", pcg32());
+	run("xoshiro256+", xoshiro256p());
+#ifdef TOYTRACER_RNG_RDRAND
+	run("rdrand     ", rdrand_rng());
+#else
+	std::cout << "  rdrand: build with TOYTRACER_RNG_RDRAND to include it" << std::endl;
+#endif
+	return 0;
+}
+
+int benchmark_scatter() {
+	// Lambertian scatter directions about random normals, the way lambertian::scatter has drawn them
+	// before and after it moved to cosine hemisphere sampling
+	const int normal_count = 1 << 16;
+	const int repeats = 32;
+	const double draws = double(normal_count) * repeats;
+
+	seed_random(4, 0);
+	std::vector<vec3> normals;
+	for (int i = 0; i < normal_count; i++)
+		normals.push_back(random_unit_vector());
+
+	std::cout << "Lambertian scatter, " << normal_count << " normals x " << repeats << " repeats" << std::endl;
+
+	// Every variant is normalized before its cosine is summed, so they do the same work downstream. The
+	// mean cosine to the normal is 2/3 for a cosine weighted lobe; printing it also keeps the loops.
+	auto report = [draws](const char* label, double seconds, real cosine_sum) {
+		std::cout << "  " << label << ": " << (draws / seconds) / 1e6 << " M directions/s ("
+		          << (seconds * 1e9) / draws << " ns/direction, mean cosine " << cosine_sum / real(draws) << ")" << std::endl;
+	};
+
+	// Normal plus a random unit vector, the direction lambertian::scatter built before
+	auto unit_vector_lobe = [](const vec3& n, const vec3& unit) {
+		vec3 direction = n + unit;
+		if (direction.near_zero())
+			direction = n;
+		return direction;
+	};
+
+	auto time_generator = [&](const char* label, auto&& direction) {
+		real sum = 0;
+		const double seconds = time_seconds([&] {
+			for (int rep = 0; rep < repeats; rep++) {
+				for (const auto& n : normals)
+					sum += dot(unit_vector(direction(n)), n);
+			}
+		});
+		report(label, seconds, sum);
+	};
+
+	// random_double, as the renderer drew every number before the samplers
+	time_generator("rejection, random_double        ", [&](const vec3& n) {
+		vec3 p;
+		do {
+			p = vec3::random(-1, 1);
+		} while (p.length_squared() >= 1);
+		return unit_vector_lobe(n, unit_vector(p));
+	});
+	time_generator("unit vector, random_double      ", [&](const vec3& n) {
+		const double u = random_double();
+		return unit_vector_lobe(n, sample_unit_vector(u, random_double()));
+	});
+	time_generator("cosine hemisphere, random_double", [&](const vec3& n) {
+		const double u = random_double();
+		return onb(n).local(sample_cosine_hemisphere(u, random_double()));
+	});
+
+	// The default sampler, as the renderer draws now. The first is lambertian_scatter as it was before
+	// cosine hemisphere sampling, the second is lambertian_scatter itself.
+	sampler s(sampler_kind::sobol);
+	int sample_index = 0;
+	auto next_sample = [&](const vec3& n) {
+		s.start(int(&n - normals.data()), 0, uint32_t(sample_index++ / normal_count));
+		return s.get_2d();
+	};
+	time_generator("unit vector, sobol              ", [&](const vec3& n) {
+		const sample2 d = next_sample(n);
+		return unit_vector_lobe(n, sample_unit_vector(d.u, d.v));
+	});
+	hit_result result;
+	time_generator("lambertian_scatter, sobol       ", [&](const vec3& n) {
+		result.normal = n;
+		s.start(int(&n - normals.data()), 0, uint32_t(sample_index++ / normal_count));
+		color attenuation;
+		ray scattered;
+		lambertian_scatter(color(1, 1, 1), result, s, attenuation, scattered);
+		return scattered.direction();
+	});
+	return 0;
+}
+
+int run_benchmark(const std::string& name, const hittable& world, const camera& cam, int width, int height) {
+	if (name == "sphere")
+		return benchmark_sphere_hit();
+	if (name == "packets")
+		return benchmark_primary_packets(world, cam, width, height);
+	if (name == "dispatch")
+		return benchmark_dispatch();
+	if (name == "resolve")
+		return benchmark_resolve(width, height);
+	if (name == "scatter")
+		return benchmark_scatter();
+	if (name == "rng")
+		return benchmark_rng();
+
+	std::cout << "Unknown benchmark: " << name << " (available: sphere, packets, dispatch, resolve, scatter, rng)" << std::endl;
+	return 1;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Tileable blue-noise dither mask built with Ulichney's void-and-cluster method. Each texel holds its
+// rank in [0, 1), and any threshold of the mask gives points spread evenly with no low frequencies,
+// so offsetting neighboring pixels' samples by it pushes their error to high frequencies where it
+// reads as fine grain and filters away easily.
+
+const int blue_noise_size = 64; // Texels per side; the mask wraps around at the edges
+const float blue_noise_sigma = 1.5f;
+
+class blue_noise_builder {
+	public:
+		blue_noise_builder() : ones(texel_count, 0), energy(texel_count, 0.0f), kernel(texel_count) {
+			for (int dy = 0; dy < blue_noise_size; dy++) {
+				for (int dx = 0; dx < blue_noise_size; dx++) {
+					const int wx = std::min(dx, blue_noise_size - dx);
+					const int wy = std::min(dy, blue_noise_size - dy);
+					kernel[dx + dy * blue_noise_size] = std::exp(-float(wx * wx + wy * wy) / (2.0f * blue_noise_sigma * blue_noise_sigma));
+				}
+			}
+		}
+
+		std::vector<float> build() {
+			// Start from about a tenth of the texels set at random, then relax them into an even pattern by
+			// moving the tightest cluster into the largest void until that just moves the same texel back
+			const int initial_count = texel_count / 10;
+			uint32_t state = 0x2545f491u;
+			for (int count = 0; count < initial_count;) {
+				state = state * 1664525u + 1013904223u;
+				const int i = int((state >> 8) % texel_count);
+				if (!ones[i]) {
+					toggle(i);
+					count++;
+				}
+			}
+
+			for (int step = 0; step < texel_count; step++) {
+				const int cluster = tightest_cluster(1);
+				toggle(cluster);
+				const int gap = largest_void();
+				toggle(gap);
+				if (gap == cluster)
+					break;
+			}
+
+			std::vector<int> rank(texel_count);
+			const std::vector<uint8_t> initial_ones = ones;
+			const std::vector<float> initial_energy = energy;
+
+			// Phase 1: the initial points take the lowest ranks, tightest cluster last
+			for (int r = initial_count - 1; r >= 0; r--) {
+				const int i = tightest_cluster(1);
+				toggle(i);
+				rank[i] = r;
+			}
+
+			// Phase 2: fill the largest void up to half the texels
+			ones = initial_ones;
+			energy = initial_energy;
+			for (int r = initial_count; r < texel_count / 2; r++) {
+				const int i = largest_void();
+				toggle(i);
+				rank[i] = r;
+			}
+
+			// Phase 3: the unset texels are now the minority, so rank them by clustering instead. Energy is
+			// rebuilt from the unset texels, whose tightest cluster is the next to set.
+			std::fill(energy.begin(), energy.end(), 0.0f);
+			for (int i = 0; i < texel_count; i++) {
+				if (!ones[i])
+					splat(i, 1.0f);
+			}
+			for (int r = texel_count / 2; r < texel_count; r++) {
+				const int i = tightest_cluster(0);
+				ones[i] = 1;
+				splat(i, -1.0f);
+				rank[i] = r;
+			}
+
+			std::vector<float> mask(texel_count);
+			for (int i = 0; i < texel_count; i++)
+				mask[i] = (float(rank[i]) + 0.5f) / texel_count;
+			return mask;
+		}
+
+	private:
+		static const int texel_count = blue_noise_size * blue_noise_size;
+
+		std::vector<uint8_t> ones;
+		std::vector<float> energy; // Gaussian weighted count of nearby set texels, wrapping at the edges
+		std::vector<float> kernel;
+
+		void splat(int i, float sign) {
+			const int x = i % blue_noise_size, y = i / blue_noise_size;
+			for (int ty = 0; ty < blue_noise_size; ty++) {
+				const int dy = (ty - y + blue_noise_size) % blue_noise_size;
+				for (int tx = 0; tx < blue_noise_size; tx++) {
+					const int dx = (tx - x + blue_noise_size) % blue_noise_size;
+					energy[tx + ty * blue_noise_size] += sign * kernel[dx + dy * blue_noise_size];
+				}
+			}
+		}
+
+		void toggle(int i) {
+			ones[i] = !ones[i];
+			splat(i, ones[i] ? 1.0f : -1.0f);
+		}
+
+		// Texel with the given value where energy is highest
+		int tightest_cluster(uint8_t value) const {
+			int best = -1;
+			for (int i = 0; i < texel_count; i++) {
+				if (ones[i] == value && (best < 0 || energy[i] > energy[best]))
+					best = i;
+			}
+			return best;
+		}
+
+		// Unset texel where energy is lowest
+		int largest_void() const {
+			int best = -1;
+			for (int i = 0; i < texel_count; i++) {
+				if (!ones[i] && (best < 0 || energy[i] < energy[best]))
+					best = i;
+			}
+			return best;
+		}
+};
+
+// The mask is built on first use, which takes a few tens of milliseconds
+inline const std::vector<float>& blue_noise_mask() {
+	static const std::vector<float> mask = blue_noise_builder().build();
+	return mask;
+}
+
+inline float blue_noise(int x, int y) {
+	const int mask = blue_noise_size - 1;
+	return blue_noise_mask()[(x & mask) + (y & mask) * blue_noise_size];
+}
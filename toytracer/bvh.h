@@ -0,0 +1,181 @@
+#pragma once
+
+#include "toytracer.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <vector>
+
+class bvh_node : public hittable {
+	public:
+		bvh_node() {}
+		bvh_node(const hittable_list& list) : bvh_node(list.objects) {}
+		bvh_node(const std::vector<shared_ptr<hittable>>& src_objects);
+
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_result& result) const override;
+		virtual bool bounding_box(aabb& output_box) const override;
+		virtual void hit_packet(const ray_packet& packet, real t_min, packet_hit& hits) const override;
+
+	public:
+		shared_ptr<hittable> left;
+		shared_ptr<hittable> right;
+		aabb box;
+
+	private:
+		// Number of buckets centroids are binned into when evaluating the surface area heuristic
+		static const int bin_count = 12;
+
+		struct build_primitive {
+			shared_ptr<hittable> object;
+			aabb box;
+			point3 centroid;
+		};
+
+		bvh_node(std::vector<build_primitive>& primitives, size_t start, size_t end);
+
+		static shared_ptr<hittable> build_child(std::vector<build_primitive>& primitives, size_t start, size_t end);
+};
+
+bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects) {
+	std::vector<build_primitive> primitives;
+	primitives.reserve(src_objects.size());
+
+	for (const auto& object : src_objects) {
+		build_primitive primitive;
+		if (!object->bounding_box(primitive.box))
+			std::cerr << "No bounding box in bvh_node constructor.\n";
+		primitive.object = object;
+		primitive.centroid = primitive.box.centroid();
+		primitives.push_back(primitive);
+	}
+
+	if (primitives.empty())
+		return;
+
+	if (primitives.size() == 1) {
+		left = right = primitives[0].object;
+		box = primitives[0].box;
+		return;
+	}
+
+	*this = bvh_node(primitives, 0, primitives.size());
+}
+
+bvh_node::bvh_node(std::vector<build_primitive>& primitives, size_t start, size_t end) {
+	aabb centroid_bounds;
+	for (size_t i = start; i < end; i++) {
+		box.expand(primitives[i].box);
+		centroid_bounds.expand(primitives[i].centroid);
+	}
+
+	size_t object_span = end - start;
+	if (object_span == 2) {
+		left = primitives[start].object;
+		right = primitives[start + 1].object;
+		return;
+	}
+
+	// Bin centroids along each axis and pick the split plane with the lowest SAH cost
+	int best_axis = -1;
+	int best_split = 0;
+	double best_cost = infinity;
+
+	for (int axis = 0; axis < 3; axis++) {
+		auto axis_min = centroid_bounds.min()[axis];
+		auto extent = centroid_bounds.max()[axis] - axis_min;
+		if (extent <= 0)
+			continue;
+
+		aabb bin_boxes[bin_count];
+		size_t bin_counts[bin_count] = {};
+		auto scale = bin_count / extent;
+
+		for (size_t i = start; i < end; i++) {
+			int b = std::min(bin_count - 1, static_cast<int>((primitives[i].centroid[axis] - axis_min) * scale));
+			bin_counts[b]++;
+			bin_boxes[b].expand(primitives[i].box);
+		}
+
+		// Sweep from the right to get the area and count of everything right of each split plane
+		double right_areas[bin_count];
+		size_t right_counts[bin_count];
+		aabb right_box;
+		size_t right_count = 0;
+		for (int b = bin_count - 1; b > 0; b--) {
+			right_box.expand(bin_boxes[b]);
+			right_count += bin_counts[b];
+			right_areas[b] = right_box.surface_area();
+			right_counts[b] = right_count;
+		}
+
+		// Then sweep from the left, evaluating the cost of splitting before bin b
+		aabb left_box;
+		size_t left_count = 0;
+		for (int b = 1; b < bin_count; b++) {
+			left_box.expand(bin_boxes[b - 1]);
+			left_count += bin_counts[b - 1];
+			if (left_count == 0 || right_counts[b] == 0)
+				continue;
+
+			auto cost = left_count * left_box.surface_area() + right_counts[b] * right_areas[b];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b;
+			}
+		}
+	}
+
+	size_t mid;
+	if (best_axis < 0) {
+		// All centroids coincide, so any split is as good as another
+		mid = start + object_span / 2;
+	} else {
+		auto axis_min = centroid_bounds.min()[best_axis];
+		auto scale = bin_count / (centroid_bounds.max()[best_axis] - axis_min);
+		auto first = primitives.begin();
+		mid = std::partition(first + start, first + end, [&](const build_primitive& p) {
+			int b = std::min(bin_count - 1, static_cast<int>((p.centroid[best_axis] - axis_min) * scale));
+			return b < best_split;
+		}) - first;
+	}
+
+	left = build_child(primitives, start, mid);
+	right = build_child(primitives, mid, end);
+}
+
+shared_ptr<hittable> bvh_node::build_child(std::vector<build_primitive>& primitives, size_t start, size_t end) {
+	// Single objects are referenced directly rather than wrapped in a node of their own
+	if (end - start == 1)
+		return primitives[start].object;
+	return shared_ptr<bvh_node>(new bvh_node(primitives, start, end));
+}
+
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_result& result) const {
+	if (!left || !box.hit(r, t_min, t_max))
+		return false;
+
+	bool hit_left = left->hit(r, t_min, t_max, result);
+	if (right == left)
+		return hit_left;
+
+	bool hit_right = right->hit(r, t_min, hit_left ? result.t : t_max, result);
+	return hit_left || hit_right;
+}
+
+bool bvh_node::bounding_box(aabb& output_box) const {
+	output_box = box;
+	return true;
+}
+
+void bvh_node::hit_packet(const ray_packet& packet, real t_min, packet_hit& hits) const {
+	// The whole packet descends together while any of its lanes still overlaps the node
+	if (!left || !box.hit_packet(packet, t_min, hits.t))
+		return;
+
+	left->hit_packet(packet, t_min, hits);
+	if (right != left)
+		right->hit_packet(packet, t_min, hits);
+}
@@ -4,10 +4,10 @@
 
 class camera {
 	public:
-		camera(point3 position, vec3 forward, double vfov, double aspect_ratio) {
+		camera(point3 position, vec3 forward, real vfov, real aspect_ratio) {
 			auto theta = degrees_to_radians(vfov);
-			auto h = tan(theta / 2.0);
-			viewport_height = 2.0 * h;
+			auto h = tan(theta / 2);
+			viewport_height = 2 * h;
 			viewport_width = aspect_ratio * viewport_height;
 
 			this->forward = unit_vector(forward);
@@ -16,11 +16,24 @@ class camera {
 			recalculate();
 		}
 
-		ray get_ray(double u, double v) const {
+		ray get_ray(real u, real v) const {
 			return ray(origin, lower_left_corner + u * horizontal + v * vertical - origin);
 		}
 
-		point3 get_origin() {
+		// Finds the viewport coordinates (u, v), as get_ray takes them, of the ray through p. Returns false
+		// if p is not in front of the camera.
+		bool project(const point3& p, real& u, real& v) const {
+			vec3 d = p - origin;
+			auto depth = -dot(d, forward); // The viewport lies along -forward, see recalculate
+			if (depth <= 0)
+				return false;
+
+			u = dot(d, right) / (depth * viewport_width) + real(0.5);
+			v = dot(d, up) / (depth * viewport_height) + real(0.5);
+			return true;
+		}
+
+		point3 get_origin() const {
 			return origin;
 		}
 
@@ -39,7 +52,7 @@ class camera {
 			set_origin(new_position);
 		}
 
-		void rotate(double x, double y) {
+		void rotate(real x, real y) {
 			forward = unit_vector(forward + right * x + up * y);
 			recalculate();
 		}
@@ -54,10 +67,10 @@ class camera {
 		vec3 horizontal;
 		vec3 vertical;
 
-		double aspect_ratio = 16.0 / 9.0;
-		double viewport_height;
-		double viewport_width;
-		double focal_length = 1.0;
+		real aspect_ratio = real(16.0 / 9.0);
+		real viewport_height;
+		real viewport_width;
+		real focal_length = 1;
 
 		void recalculate() {
 			right = unit_vector(cross(vec3(0, 1, 0), forward));
@@ -2,6 +2,11 @@
 
 #include "vec3.h"
 
+// Relative luminance of a linear Rec. 709 color
+inline real luminance(const color& c) {
+	return real(0.2126) * c.x() + real(0.7152) * c.y() + real(0.0722) * c.z();
+}
+
 void write_color(std::ostream& out, vec3 pixel_color) {
 	out << static_cast<int>(255.999 * pixel_color.x()) << ' '
 		<< static_cast<int>(255.999 * pixel_color.y()) << ' '
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// Runs the display and input loop at a fixed rate, independent of how fast the workers render, and
+// measures how the main thread and the workers spent each stats interval.
+class frame_pacer {
+	public:
+		struct frame_stats {
+			double interval_seconds = 0;  // Wall time the stats below cover
+			double frame_rate = 0;        // Frames actually displayed per second
+			double main_seconds = 0;      // Main thread time per frame, excluding the pacing sleep
+			double main_fraction = 0;     // Share of wall time the main thread was busy
+			double worker_fraction = 0;   // Share of total worker time spent running jobs
+			double job_seconds = 0;       // Average job run time; 0 until a job has completed
+		};
+
+		frame_pacer(double frame_rate, double stats_interval = 0.5)
+			: frame_interval(1.0 / frame_rate), stats_interval(stats_interval) {
+			frame_start = interval_start = clock::now();
+		}
+
+		// Starts a frame and returns the time since the previous one started, for scaling movement
+		double begin_frame() {
+			auto now = clock::now();
+			double delta = seconds(frame_start, now);
+			frame_start = now;
+			return delta;
+		}
+
+		// Ends the main thread's work for the frame, updates the stats once per interval, then sleeps
+		// off whatever is left of the frame. Returns true when the stats were updated.
+		bool end_frame(const thread_pool& pool) {
+			auto now = clock::now();
+			interval_main_seconds += seconds(frame_start, now);
+			interval_frames++;
+
+			bool updated = false;
+			const double elapsed = seconds(interval_start, now);
+			if (elapsed >= stats_interval) {
+				auto pool_stats = pool.get_stats();
+				const double busy = pool_stats.busy_seconds - interval_busy_seconds;
+				const uint64_t jobs = pool_stats.completed - interval_jobs;
+
+				stats.interval_seconds = elapsed;
+				stats.frame_rate = interval_frames / elapsed;
+				stats.main_seconds = interval_main_seconds / interval_frames;
+				stats.main_fraction = interval_main_seconds / elapsed;
+				stats.worker_fraction = busy / (elapsed * pool.size());
+				if (jobs > 0)
+					stats.job_seconds = busy / jobs;
+
+				interval_start = now;
+				interval_main_seconds = 0;
+				interval_frames = 0;
+				interval_busy_seconds = pool_stats.busy_seconds;
+				interval_jobs = pool_stats.completed;
+				updated = true;
+			}
+
+			const double remaining = frame_interval - seconds(frame_start, now);
+			if (remaining > 0)
+				std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+			return updated;
+		}
+
+		const frame_stats& get_stats() const { return stats; }
+
+		double get_frame_interval() const { return frame_interval; }
+
+	private:
+		using clock = std::chrono::steady_clock;
+
+		static double seconds(clock::time_point from, clock::time_point to) {
+			return std::chrono::duration<double>(to - from).count();
+		}
+
+		double frame_interval;
+		double stats_interval;
+		clock::time_point frame_start;
+		clock::time_point interval_start;
+
+		double interval_main_seconds = 0;
+		int interval_frames = 0;
+		double interval_busy_seconds = 0;
+		uint64_t interval_jobs = 0;
+
+		frame_stats stats;
+};
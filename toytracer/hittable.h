@@ -1,6 +1,8 @@
 #pragma once
 
+#include "aabb.h"
 #include "ray.h"
+#include "ray_packet.h"
 #include "toytracer.h"
 
 class material;
@@ -8,8 +10,8 @@ class material;
 struct hit_result {
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> mat_ptr;
-	double t;
+	const material* mat_ptr; // Non-owning; materials are kept alive by the objects in the scene
+	real t;
 	bool front_face;
 
 	inline void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -18,7 +20,36 @@ struct hit_result {
 	}
 };
 
+// Closest hits found so far for each lane of a ray_packet. t doubles as each lane's t_max.
+struct packet_hit {
+	alignas(32) real t[packet_width];
+	hit_result result[packet_width];
+	real initial_t_max;
+
+	void reset(const ray_packet& packet, real t_max) {
+		// Padding lanes get an empty interval so no hit can ever be accepted for them
+		for (int lane = 0; lane < packet_width; lane++)
+			t[lane] = lane < packet.lane_count ? t_max : -infinity;
+		initial_t_max = t_max;
+	}
+
+	bool hit(int lane) const { return t[lane] < initial_t_max; }
+};
+
 class hittable {
 	public:
-		virtual bool hit(const ray& r, double t_min, double t_max, hit_result& result) const = 0;
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_result& result) const = 0;
+		virtual bool bounding_box(aabb& output_box) const = 0;
+
+		// Intersects every lane of a packet, tightening hits.t where a lane finds a closer hit.
+		// The default traces the lanes one at a time; primitives override it with a packet kernel.
+		virtual void hit_packet(const ray_packet& packet, real t_min, packet_hit& hits) const {
+			hit_result temp_result;
+			for (int lane = 0; lane < packet.lane_count; lane++) {
+				if (hit(packet.get_ray(lane), t_min, hits.t[lane], temp_result)) {
+					hits.t[lane] = temp_result.t;
+					hits.result[lane] = temp_result;
+				}
+			}
+		}
 };
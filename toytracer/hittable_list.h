@@ -16,13 +16,15 @@ class hittable_list : public hittable {
 		void clear() { objects.clear(); }
 		void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-		virtual bool hit(const ray& r, double t_min, double t_max, hit_result& result) const override;
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_result& result) const override;
+		virtual bool bounding_box(aabb& output_box) const override;
+		virtual void hit_packet(const ray_packet& packet, real t_min, packet_hit& hits) const override;
 
 	public:
 		std::vector<shared_ptr<hittable>> objects;
 };
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_result& result) const {
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_result& result) const {
 	hit_result temp_result;
 	bool hit_anything = false;
 	auto closest_so_far = t_max;
@@ -37,3 +39,22 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_result& re
 
 	return hit_anything;
 }
+
+bool hittable_list::bounding_box(aabb& output_box) const {
+	if (objects.empty()) return false;
+
+	aabb temp_box;
+	output_box = aabb();
+
+	for (const auto& object : objects) {
+		if (!object->bounding_box(temp_box)) return false;
+		output_box.expand(temp_box);
+	}
+
+	return true;
+}
+
+void hittable_list::hit_packet(const ray_packet& packet, real t_min, packet_hit& hits) const {
+	for (const auto& object : objects)
+		object->hit_packet(packet, t_min, hits);
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "tonemap.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Writers for linear HDR images stored top row first. 8-bit formats go through the same tonemap and
+// gamma 2.0 curve the interactive view uses; PFM keeps the linear values.
+
+// Tonemaps one row of the image into packed RGB bytes
+inline void tonemap_row(const std::vector<color>& image, int width, int y, const tonemap_settings& tonemap, uint8_t* out) {
+	std::vector<float> linear(width * 3);
+	for (int x = 0; x < width; x++) {
+		const auto& c = image[y * width + x];
+		linear[x * 3 + 0] = float(c.x());
+		linear[x * 3 + 1] = float(c.y());
+		linear[x * 3 + 2] = float(c.z());
+	}
+	tonemap_channels(tonemap, 1.0f, linear.data(), out, linear.size());
+}
+
+bool write_ppm(const std::string& path, const std::vector<color>& image, int width, int height, const tonemap_settings& tonemap) {
+	std::ofstream out(path, std::ios::binary);
+	if (!out)
+		return false;
+
+	out << "P6\n" << width << ' ' << height << "\n255\n";
+	std::vector<uint8_t> row(width * 3);
+	for (int y = 0; y < height; y++) {
+		tonemap_row(image, width, y, tonemap, row.data());
+		out.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+	return static_cast<bool>(out);
+}
+
+bool write_pfm(const std::string& path, const std::vector<color>& image, int width, int height) {
+	std::ofstream out(path, std::ios::binary);
+	if (!out)
+		return false;
+
+	// Negative scale marks little-endian data; rows are stored bottom to top
+	out << "PF\n" << width << ' ' << height << "\n-1.0\n";
+	std::vector<float> row(width * 3);
+	for (int y = height - 1; y >= 0; y--) {
+		for (int x = 0; x < width; x++) {
+			const auto& c = image[y * width + x];
+			row[x * 3 + 0] = static_cast<float>(c.x());
+			row[x * 3 + 1] = static_cast<float>(c.y());
+			row[x * 3 + 2] = static_cast<float>(c.z());
+		}
+		out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+	}
+	return static_cast<bool>(out);
+}
+
+namespace png_detail {
+	inline uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc = 0) {
+		static uint32_t table[256];
+		static bool table_ready = false;
+		if (!table_ready) {
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++)
+					c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				table[n] = c;
+			}
+			table_ready = true;
+		}
+
+		crc = ~crc;
+		for (size_t i = 0; i < length; i++)
+			crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	inline void put_u32(std::vector<uint8_t>& out, uint32_t v) {
+		out.push_back(static_cast<uint8_t>(v >> 24));
+		out.push_back(static_cast<uint8_t>(v >> 16));
+		out.push_back(static_cast<uint8_t>(v >> 8));
+		out.push_back(static_cast<uint8_t>(v));
+	}
+
+	inline void write_chunk(std::ofstream& out, const char* type, const std::vector<uint8_t>& data) {
+		std::vector<uint8_t> chunk;
+		put_u32(chunk, static_cast<uint32_t>(data.size()));
+		chunk.insert(chunk.end(), type, type + 4);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+		put_u32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+		out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+	}
+}
+
+bool write_png(const std::string& path, const std::vector<color>& image, int width, int height, const tonemap_settings& tonemap) {
+	std::ofstream out(path, std::ios::binary);
+	if (!out)
+		return false;
+
+	// Raw scanlines, each prefixed with filter type 0 (none)
+	std::vector<uint8_t> raw;
+	raw.resize(static_cast<size_t>(height) * (width * 3 + 1));
+	for (int y = 0; y < height; y++) {
+		uint8_t* row = &raw[static_cast<size_t>(y) * (width * 3 + 1)];
+		row[0] = 0;
+		tonemap_row(image, width, y, tonemap, row + 1);
+	}
+
+	// zlib stream made of uncompressed deflate blocks, so no compression library is needed
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	size_t offset = 0;
+	do {
+		size_t block = std::min<size_t>(raw.size() - offset, 65535);
+		bool final_block = offset + block == raw.size();
+		zlib.push_back(final_block ? 1 : 0);
+		zlib.push_back(static_cast<uint8_t>(block));
+		zlib.push_back(static_cast<uint8_t>(block >> 8));
+		zlib.push_back(static_cast<uint8_t>(~block));
+		zlib.push_back(static_cast<uint8_t>(~block >> 8));
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block);
+		offset += block;
+	} while (offset < raw.size());
+
+	uint32_t a = 1, b = 0;
+	for (auto byte : raw) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	png_detail::put_u32(zlib, (b << 16) | a);
+
+	std::vector<uint8_t> header;
+	png_detail::put_u32(header, width);
+	png_detail::put_u32(header, height);
+	header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8-bit depth, truecolor, no interlace
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+	png_detail::write_chunk(out, "IHDR", header);
+	png_detail::write_chunk(out, "IDAT", zlib);
+	png_detail::write_chunk(out, "IEND", {});
+	return static_cast<bool>(out);
+}
+
+bool write_image(const std::string& path, const std::vector<color>& image, int width, int height, const tonemap_settings& tonemap = tonemap_settings()) {
+	auto dot = path.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+	for (auto& ch : extension)
+		ch = static_cast<char>(tolower(ch));
+
+	if (extension == ".ppm")
+		return write_ppm(path, image, width, height, tonemap);
+	if (extension == ".pfm")
+		return write_pfm(path, image, width, height);
+	if (extension == ".png")
+		return write_png(path, image, width, height, tonemap);
+
+	std::cout << "Unsupported output format: " << path << " (use .ppm, .png or .pfm)" << std::endl;
+	return false;
+}
@@ -3,118 +3,627 @@
 
 #include "toytracer.h"
 
+#include "accumulation_buffer.h"
+#include "benchmark.h"
+#include "bvh.h"
+#include "frame_pacer.h"
 #include "color.h"
 #include "color32.h"
+#include "denoiser.h"
 #include "hittable_list.h"
+#include "image_io.h"
 #include "sphere.h"
+#include "sphere_set.h"
 #include "camera.h"
 #include "material.h"
+#include "options.h"
+#include "sampler.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
+#include "wavefront.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
-#include <thread>
-#include <future>
+#include <atomic>
 #include <chrono>
 
 using std::vector;
-using std::thread;
-using std::future;
-
-// Image
-const auto aspect_ratio = 16.0 / 9.0;
-const int image_width = 640*2;
-const int image_height = 360*2; // static_cast<int>(image_width / aspect_ratio);
-const int pixel_count = image_width * image_height;
+
+// Image, sized from the command line before anything is rendered
+int image_width = 640*2;
+int image_height = 360*2;
 const int max_bounces = 8;
 
 // Performance
-const int batch_size = image_width * 5; // Pixels to render per thread
-const int batch_count = 32;
+const int tile_size = 32; // Tiles are tile_size x tile_size pixels, one tile per job
+const int queued_job_count = 32; // Tile jobs kept queued on the thread pool until job times are known
+const double queued_work_frames = 2.0; // After that, queue about this many display frames of work for the pool
+const double restart_wait_frames = 0.5; // Longest the display loop waits for stale tiles to stop on a restart
+const double tile_split_factor = 4.0; // Tiles costing this many times the average are split on restart
 
 // Scene
 hittable_list scene;
 
+// Integrator
+roulette_settings roulette;
+bool packet_tracing = true; // Trace primary rays as packets of packet_width neighboring pixels
+bool wavefront = false; // Trace a whole tile one bounce at a time instead of one path at a time
+sampler_kind sampling = sampler_kind::sobol; // Where pixel jitter, scatter directions and roulette draw from
+
 // Debug visualizations
 bool render_normals;
 
-color ray_color(const ray& r, int depth) {
-	if (depth >= max_bounces)
-		return color(0, 0, 0);
-	
-	// Test for scene intersections
-	hit_result result;
-	if (scene.hit(r, 0.001, infinity, result)) {
+// Bumped whenever the image is invalidated; tiles from an older generation stop early
+std::atomic<uint32_t> render_generation{ 0 };
+
+// Ray and bounce statistics; each thread counts locally and flushes into the totals at the end of a job
+thread_local uint64_t thread_ray_count = 0;
+std::atomic<uint64_t> total_ray_count{ 0 };
+thread_local wavefront_stats thread_bounce_stats(max_bounces);
+wavefront_stats total_bounce_stats(max_bounces);
+
+void flush_thread_stats() {
+	total_ray_count += thread_ray_count;
+	thread_ray_count = 0;
+	if (wavefront)
+		total_bounce_stats.merge(thread_bounce_stats);
+}
+
+color sky_color(const ray& r) {
+	vec3 unit_direction = unit_vector(r.direction());
+	auto t = real(0.5) * (unit_direction.y() + 1);
+	return (1 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+}
+
+// Russian roulette: continue with probability p and divide by p, which keeps the estimate unbiased
+bool roulette_survives(int depth, color& throughput, sampler& s) {
+	if (depth + 1 < roulette.start_depth)
+		return true;
+
+	auto p = fmax(throughput.x(), fmax(throughput.y(), throughput.z()));
+	p = fmin(fmax(p, real(roulette.min_probability)), real(1));
+	s.set_dimension(bounce_dimension(depth) + roulette_dimension);
+	if (s.get_1d() >= p)
+		return false;
+	throughput /= p;
+	return true;
+}
+
+// Shades a primary ray whose first intersection is already known and follows the rest of its path
+color continue_path(const ray& primary, bool hit, hit_result result, sampler& s) {
+	// Path throughput is carried forward so paths can be terminated as soon as it gets small
+	ray r = primary;
+	color throughput(1, 1, 1);
+
+	for (int depth = 0; depth < max_bounces; depth++) {
+		// Test for scene intersections; the primary hit came in with the call
+		if (depth > 0) {
+			thread_ray_count++;
+			hit = scene.hit(r, self_intersection_epsilon, infinity, result);
+		}
+
+		if (!hit) {
+			// Miss, return sky gradient
+			return throughput * sky_color(r);
+		}
+
 		if (render_normals) {
 			// Hit, return surface normal
-			return 0.5 * color(result.normal.x() + 1,
+			return real(0.5) * color(result.normal.x() + 1,
 			                   result.normal.y() + 1,
 			                   result.normal.z() + 1);
-		} else {
-			ray scattered;
-			color attenuation;
-			if (result.mat_ptr->scatter(r, result, attenuation, scattered))
-				return attenuation * ray_color(scattered, depth + 1);
+		}
+
+		ray scattered;
+		color attenuation;
+		s.set_dimension(bounce_dimension(depth));
+		if (!result.mat_ptr->scatter(r, result, s, attenuation, scattered))
 			return color(0, 0, 0);
+
+		throughput = throughput * attenuation;
+		r = scattered;
+
+		if (!roulette_survives(depth, throughput, s))
+			return color(0, 0, 0);
+	}
+
+	return color(0, 0, 0);
+}
+
+first_hit make_first_hit(const ray& primary, bool hit, const hit_result& result) {
+	if (!hit)
+		return { point3(infinity, infinity, infinity), vec3(0, 0, 0), sky_color(primary) };
+	return { result.p, result.normal, result.mat_ptr->surface_albedo() };
+}
+
+// Traces the path starting with a primary ray. hit_info, when given, receives what the primary ray hit.
+color ray_color(const ray& primary, sampler& s, first_hit* hit_info = nullptr) {
+	thread_ray_count++;
+	hit_result result;
+	bool hit = scene.hit(primary, self_intersection_epsilon, infinity, result);
+	if (hit_info)
+		*hit_info = make_first_hit(primary, hit, result);
+	return continue_path(primary, hit, result, s);
+}
+
+// Box filtered camera ray through pixel (x, y), jittered with the sampler's pixel dimensions
+ray jittered_pixel_ray(const camera& cam, int x, int y, sampler& s) {
+	s.set_dimension(0);
+	const sample2 jitter = s.get_2d();
+	auto u = (real(x) + real(jitter.u)) / (image_width - 1);
+	auto v = (real((image_height - 1) - y) + real(jitter.v)) / (image_height - 1);
+	return cam.get_ray(u, v);
+}
+
+// Traces one sample for each of count (at most packet_width) pixels starting at (x, y), stride pixels
+// apart. Each pixel's sampler starts from its own sample index, so packet and single-ray tracing give
+// the same image. first_hits, if not null, receives what each primary ray hit.
+void trace_pixels(const camera& cam, int x, int y, int count, const uint32_t sample_indices[], color results[], first_hit first_hits[] = nullptr, int stride = 1) {
+	// Strided passes take one sample per stride x stride block, so their samplers are indexed by block.
+	// Neighboring samples then read neighboring blue-noise texels rather than every stride-th one.
+	sampler lane_samplers[packet_width];
+	for (int lane = 0; lane < count; lane++) {
+		lane_samplers[lane] = sampler(sampling);
+		lane_samplers[lane].start((x + lane * stride) / stride, y / stride, sample_indices[lane]);
+	}
+	auto pixel_ray = [&cam, y, &lane_samplers, x, stride](int lane) {
+		return jittered_pixel_ray(cam, x + lane * stride, y, lane_samplers[lane]);
+	};
+
+	if (!packet_tracing) {
+		for (int lane = 0; lane < count; lane++)
+			results[lane] = ray_color(pixel_ray(lane), lane_samplers[lane], first_hits ? &first_hits[lane] : nullptr);
+		return;
+	}
+
+	// Primary rays of neighboring pixels are coherent, so they traverse the scene as one packet
+	ray_packet packet;
+	packet.lane_count = count;
+	for (int lane = 0; lane < count; lane++)
+		packet.set_lane(lane, pixel_ray(lane));
+	packet.pad();
+
+	packet_hit hits;
+	hits.reset(packet, infinity);
+	scene.hit_packet(packet, self_intersection_epsilon, hits);
+	thread_ray_count += count;
+
+	// Secondary bounces diverge, so from here on every lane follows its own path
+	for (int lane = 0; lane < count; lane++) {
+		if (first_hits)
+			first_hits[lane] = make_first_hit(packet.get_ray(lane), hits.hit(lane), hits.result[lane]);
+		results[lane] = continue_path(packet.get_ray(lane), hits.hit(lane), hits.result[lane], lane_samplers[lane]);
+	}
+}
+
+// Traces a low resolution pass over a tile: one sample per block x block pixels, taken at the block's
+// top-left pixel and repeated over the whole block. Returns false if the pass went stale.
+bool trace_preview(const camera& cam, const tile_scheduler::tile& t, int block, uint32_t generation, color results[], first_hit first_hits[]) {
+	// Every camera move starts a new generation, so using it as the sample index gives each preview
+	// frame a fresh rotation of the sample pattern instead of repeating one noise pattern while moving
+	uint32_t sample_indices[packet_width];
+	std::fill(sample_indices, sample_indices + packet_width, generation);
+
+	for (int y = t.y0; y < t.y1; y += block) {
+		if (render_generation.load(std::memory_order_relaxed) != generation)
+			return false;
+
+		for (int x = t.x0; x < t.x1; x += block * packet_width) {
+			const int count = std::min(packet_width, (t.x1 - x + block - 1) / block);
+			color block_colors[packet_width];
+			first_hit block_hits[packet_width];
+			trace_pixels(cam, x, y, count, sample_indices, block_colors, block_hits, block);
+
+			for (int lane = 0; lane < count; lane++) {
+				const int bx = x + lane * block;
+				for (int py = y; py < std::min(y + block, t.y1); py++) {
+					for (int px = bx; px < std::min(bx + block, t.x1); px++) {
+						const int i = (px - t.x0) + (py - t.y0) * t.width();
+						results[i] = block_colors[lane];
+						first_hits[i] = block_hits[lane];
+					}
+				}
+			}
 		}
 	}
+	return true;
+}
 
-	// Miss, return sky gradient
-	vec3 unit_direction = unit_vector(r.direction());
-	auto t = 0.5 * (unit_direction.y() + 1.0);
-	return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+// Traces one sample for every pixel of a tile as a wavefront: each bounce first intersects all live
+// paths, then bins the hits by material kind and shades one kind after another. sample_indices,
+// results and first_hits (optional) hold one entry per tile pixel, row by row.
+void trace_wavefront(const camera& cam, const tile_scheduler::tile& t, const uint32_t sample_indices[], color results[], first_hit first_hits[] = nullptr) {
+	thread_local wavefront_buffers wf;
+	const int tile_width = t.x1 - t.x0;
+	const int path_count = tile_width * (t.y1 - t.y0);
+
+	wf.paths.resize(path_count);
+	wf.active.clear();
+	for (int y = t.y0; y < t.y1; y++) {
+		for (int x = t.x0; x < t.x1; x++) {
+			const uint32_t i = (x - t.x0) + (y - t.y0) * tile_width;
+			auto& path = wf.paths[i];
+			path.s = sampler(sampling);
+			path.s.start(x, y, sample_indices[i]);
+			path.r = jittered_pixel_ray(cam, x, y, path.s);
+			path.throughput = color(1, 1, 1);
+			path.radiance = color(0, 0, 0);
+			wf.active.push_back(i);
+		}
+	}
+
+	for (int depth = 0; depth < max_bounces && !wf.active.empty(); depth++) {
+		auto& stats = thread_bounce_stats[depth];
+		stats.paths += wf.active.size();
+		thread_ray_count += wf.active.size();
+
+		// Intersect: primary rays of neighboring pixels are still coherent enough for packets
+		if (depth == 0 && packet_tracing) {
+			for (size_t first = 0; first < wf.active.size(); first += packet_width) {
+				ray_packet packet;
+				packet.lane_count = static_cast<int>(std::min<size_t>(packet_width, wf.active.size() - first));
+				for (int lane = 0; lane < packet.lane_count; lane++)
+					packet.set_lane(lane, wf.paths[wf.active[first + lane]].r);
+				packet.pad();
+
+				packet_hit hits;
+				hits.reset(packet, infinity);
+				scene.hit_packet(packet, self_intersection_epsilon, hits);
+				for (int lane = 0; lane < packet.lane_count; lane++) {
+					auto& path = wf.paths[wf.active[first + lane]];
+					path.hit = hits.hit(lane);
+					path.result = hits.result[lane];
+				}
+			}
+		} else {
+			for (uint32_t i : wf.active) {
+				auto& path = wf.paths[i];
+				path.hit = scene.hit(path.r, self_intersection_epsilon, infinity, path.result);
+			}
+		}
+
+		if (depth == 0 && first_hits) {
+			for (uint32_t i : wf.active)
+				first_hits[i] = make_first_hit(wf.paths[i].r, wf.paths[i].hit, wf.paths[i].result);
+		}
+
+		// Sort: misses are finished here, hits are queued by the kind of material they landed on
+		for (auto& queue : wf.shade_queues)
+			queue.clear();
+		for (uint32_t i : wf.active) {
+			auto& path = wf.paths[i];
+			if (!path.hit) {
+				path.radiance = path.throughput * sky_color(path.r);
+				stats.misses++;
+			} else if (render_normals) {
+				const auto& n = path.result.normal;
+				path.radiance = real(0.5) * color(n.x() + 1, n.y() + 1, n.z() + 1);
+			} else {
+				wf.shade_queues[int(path.result.mat_ptr->kind())].push_back(i);
+			}
+		}
+
+		// Shade: every path in a queue runs the same scatter code
+		wf.next_active.clear();
+		for (int kind = 0; kind < material_kind_count; kind++) {
+			stats.shaded[kind] += wf.shade_queues[kind].size();
+			for (uint32_t i : wf.shade_queues[kind]) {
+				auto& path = wf.paths[i];
+
+				ray scattered;
+				color attenuation;
+				path.s.set_dimension(bounce_dimension(depth));
+				if (!path.result.mat_ptr->scatter(path.r, path.result, path.s, attenuation, scattered)) {
+					stats.absorbed++;
+				} else {
+					path.throughput = path.throughput * attenuation;
+					path.r = scattered;
+					if (roulette_survives(depth, path.throughput, path.s))
+						wf.next_active.push_back(i);
+					else
+						stats.terminated++;
+				}
+			}
+		}
+
+		// Shading went kind by kind; pixel order keeps the next bounce's paths roughly coherent
+		std::sort(wf.next_active.begin(), wf.next_active.end());
+		std::swap(wf.active, wf.next_active);
+	}
+
+	// Paths still live after max_bounces contribute nothing, as in continue_path
+	for (int i = 0; i < path_count; i++)
+		results[i] = wf.paths[i].radiance;
 }
 
-void render_pixels(camera cam, color color_sums[], uint32_t pixel_sample_counts[], std::vector<uint8_t>& pixels, int start_index, int pixels_to_render) {
-	start_index %= (image_height * image_width);
-	for (int i = start_index; i < start_index + pixels_to_render; i++) {
-		int x = i % image_width;
-		int y = floor(i / image_width);
-
-		auto u = (double(x) + random_double()) / (image_width - 1);
-		auto v = (double((image_height - 1) - y) + random_double()) / (image_height - 1);
-		ray r = cam.get_ray(u, v);
-		color_sums[i] += ray_color(r, 0);
-		pixel_sample_counts[i] += 1;
-		
-		// Divide sum by number of samples, perform gamma correction, and write final pixel value
-		auto scale = 1.0 / double(pixel_sample_counts[i]);
-		const unsigned int offset = (image_width * 4 * y) + x * 4;
-		pixels[offset + 0] = static_cast<uint8_t>(255.999 * sqrt(color_sums[i].x() * scale));
-		pixels[offset + 1] = static_cast<uint8_t>(255.999 * sqrt(color_sums[i].y() * scale));
-		pixels[offset + 2] = static_cast<uint8_t>(255.999 * sqrt(color_sums[i].z() * scale));
-		pixels[offset + 3] = SDL_ALPHA_OPAQUE;
+void render_tile(const camera& cam, accumulation_buffer& accumulation, tile_scheduler& tiles, size_t tile_index, uint32_t generation) {
+	// The tile was claimed before this job was queued, so nothing else adds passes to it
+	auto start = std::chrono::steady_clock::now();
+	const auto& t = tiles.get_tile(tile_index);
+	thread_local vector<color> samples;
+	thread_local vector<first_hit> first_hits;
+	samples.resize(t.pixel_count());
+	first_hits.resize(t.pixel_count());
+
+	// Every pixel of a tile has had the same number of passes, which is the sample index of this one
+	const uint32_t sample_index = accumulation.sample_count(tile_index);
+	const int block = accumulation.block_size(tile_index);
+	bool completed = render_generation.load(std::memory_order_relaxed) == generation;
+
+	if (!completed) {
+		// Went stale while queued
+	} else if (block > 1) {
+		completed = trace_preview(cam, t, block, generation, samples.data(), first_hits.data());
+	} else if (wavefront) {
+		// The whole tile is one wavefront, so a stale generation can only be caught before it starts
+		thread_local vector<uint32_t> sample_indices;
+		sample_indices.assign(t.pixel_count(), sample_index);
+		trace_wavefront(cam, t, sample_indices.data(), samples.data(), first_hits.data());
+	} else {
+		for (int y = t.y0; y < t.y1 && completed; y++) {
+			for (int x = t.x0; x < t.x1; x += packet_width) {
+				// Abandon the tile as soon as the image it belongs to is stale
+				if (render_generation.load(std::memory_order_relaxed) != generation) {
+					completed = false;
+					break;
+				}
+
+				const int count = std::min(packet_width, t.x1 - x);
+				uint32_t sample_indices[packet_width];
+				for (int lane = 0; lane < count; lane++)
+					sample_indices[lane] = sample_index;
+				const int offset = (x - t.x0) + (y - t.y0) * t.width();
+				trace_pixels(cam, x, y, count, sample_indices, &samples[offset], &first_hits[offset]);
+			}
+		}
 	}
+
+	// Only whole passes are added, a cancelled one is dropped
+	if (completed)
+		accumulation.add_pass(tile_index, samples.data(), first_hits.data());
+
+	flush_thread_stats();
+	auto end = std::chrono::steady_clock::now();
+	// Previews cost a fraction of a full pass, so they are kept out of the costs used to split tiles
+	tiles.release(tile_index, std::chrono::duration<double>(end - start).count(), completed && block == 1);
 }
 
-void wait_for_render_threads(future<void> render_futures[]) {
-	for (int i = 0; i < batch_count; i++) {
-		if (render_futures[i].valid()) {
-			render_futures[i].get();
+// Renders a tile at the full sample count. guides, when not null, receives each pixel's mean first hit
+// albedo and normal for the denoiser.
+void render_tile_headless(const camera& cam, vector<color>& image, vector<first_hit>* guides, tile_scheduler& tiles, size_t tile_index, int samples_per_pixel) {
+	auto start = std::chrono::steady_clock::now();
+	const auto& t = tiles.get_tile(tile_index);
+	const real sample_weight = real(1) / samples_per_pixel;
+	auto add_guide = [guides, sample_weight](int x, int y, const first_hit& hit) {
+		auto& guide = (*guides)[x + y * image_width];
+		guide.albedo += hit.albedo * sample_weight;
+		guide.normal += hit.normal * sample_weight;
+	};
+
+	if (wavefront) {
+		const int tile_width = t.x1 - t.x0;
+		const size_t path_count = tile_width * (t.y1 - t.y0);
+		vector<uint32_t> sample_indices(path_count);
+		vector<color> samples(path_count);
+		vector<color> pixel_colors(path_count);
+		vector<first_hit> hits(guides ? path_count : 0);
+		for (int s = 0; s < samples_per_pixel; s++) {
+			std::fill(sample_indices.begin(), sample_indices.end(), s);
+			trace_wavefront(cam, t, sample_indices.data(), samples.data(), guides ? hits.data() : nullptr);
+			for (size_t i = 0; i < path_count; i++)
+				pixel_colors[i] += samples[i];
+			for (size_t i = 0; i < hits.size(); i++)
+				add_guide(t.x0 + int(i) % tile_width, t.y0 + int(i) / tile_width, hits[i]);
+		}
+
+		for (int y = t.y0; y < t.y1; y++)
+			for (int x = t.x0; x < t.x1; x++)
+				image[x + y * image_width] = pixel_colors[(x - t.x0) + (y - t.y0) * tile_width] / real(samples_per_pixel);
+	} else {
+		for (int y = t.y0; y < t.y1; y++) {
+			for (int x = t.x0; x < t.x1; x += packet_width) {
+				const int count = std::min(packet_width, t.x1 - x);
+				color pixel_colors[packet_width];
+				color samples[packet_width];
+				first_hit hits[packet_width];
+				for (int s = 0; s < samples_per_pixel; s++) {
+					uint32_t sample_indices[packet_width];
+					for (int lane = 0; lane < count; lane++)
+						sample_indices[lane] = s;
+					trace_pixels(cam, x, y, count, sample_indices, samples, guides ? hits : nullptr);
+					for (int lane = 0; lane < count; lane++) {
+						pixel_colors[lane] += samples[lane];
+						if (guides)
+							add_guide(x + lane, y, hits[lane]);
+					}
+				}
+
+				for (int lane = 0; lane < count; lane++)
+					image[x + lane + y * image_width] = pixel_colors[lane] / real(samples_per_pixel);
+			}
 		}
 	}
+
+	flush_thread_stats();
+	auto end = std::chrono::steady_clock::now();
+	tiles.release(tile_index, std::chrono::duration<double>(end - start).count(), true);
 }
 
-void clear_color_sums(color color_sums[], uint32_t pixel_sample_counts[]) {
-	for (int y = 0; y < image_height; y++) {
-		for (int x = 0; x < image_width; x++) {
-			auto i = x + y * image_width;
-			color_sums[i] = color(0, 0, 0);
-			pixel_sample_counts[i] = 0;
+int render_headless(const render_options& options, const camera& cam) {
+	thread_pool pool(options.threads);
+	tile_scheduler tiles(image_width, image_height, tile_size);
+	vector<color> image(image_width * image_height);
+	vector<first_hit> guides(options.denoise ? image.size() : 0);
+
+	std::cout << "Rendering " << image_width << "x" << image_height << " at " << options.samples_per_pixel
+	          << " spp on " << pool.size() << " threads" << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < tiles.tile_count(); i++) {
+		tiles.try_acquire(i);
+		pool.submit([&cam, &image, &guides, &tiles, i, &options] {
+			render_tile_headless(cam, image, options.denoise ? &guides : nullptr, tiles, i, options.samples_per_pixel);
+		});
+	}
+	pool.wait_idle();
+	auto end = std::chrono::steady_clock::now();
+
+	const double seconds = std::chrono::duration<double>(end - start).count();
+	const uint64_t rays = total_ray_count.load();
+	std::cout << "Wall time: " << seconds << " s" << std::endl;
+	std::cout << "Rays traced: " << rays << " (" << (rays / seconds) / 1e6 << " Mrays/s)" << std::endl;
+	tiles.report(std::cout);
+	if (wavefront)
+		total_bounce_stats.report(std::cout);
+
+	if (options.denoise) {
+		auto denoise_start = std::chrono::steady_clock::now();
+		denoiser filter(image_width, image_height, pool);
+		for (size_t i = 0; i < image.size(); i++) {
+			const float pixel[3] = { float(image[i].x()), float(image[i].y()), float(image[i].z()) };
+			const float albedo[3] = { float(guides[i].albedo.x()), float(guides[i].albedo.y()), float(guides[i].albedo.z()) };
+			const float normal[3] = { float(guides[i].normal.x()), float(guides[i].normal.y()), float(guides[i].normal.z()) };
+			filter.set_pixel(i, pixel, albedo, normal);
 		}
+
+		vector<float> denoised(image.size() * 3);
+		filter.run(denoised.data());
+		for (size_t i = 0; i < image.size(); i++)
+			image[i] = color(denoised[i * 3 + 0], denoised[i * 3 + 1], denoised[i * 3 + 2]);
+
+		auto denoise_end = std::chrono::steady_clock::now();
+		std::cout << "Denoised in " << std::chrono::duration<double>(denoise_end - denoise_start).count() * 1e3 << " ms" << std::endl;
+	}
+
+	if (!write_image(options.output, image, image_width, image_height, options.tonemap)) {
+		std::cout << "Error writing image: " << options.output << std::endl;
+		return 1;
+	}
+	std::cout << "Wrote " << options.output << std::endl;
+	return 0;
+}
+
+// Number of tile jobs to keep queued: queued_work_frames display frames of work for every worker,
+// judged by recent job times. Queued jobs are dropped for free on a restart, so this only needs to be
+// large enough that the workers never run dry between two frames.
+size_t queued_job_limit(const frame_pacer& pacer, unsigned int threads) {
+	const double job_seconds = pacer.get_stats().job_seconds;
+	if (job_seconds <= 0)
+		return queued_job_count;
+
+	const double work_seconds = queued_work_frames * pacer.get_frame_interval() * threads;
+	return std::min<size_t>(std::max<size_t>(size_t(work_seconds / job_seconds), 2 * threads), 4096);
+}
+
+// Copies the given tiles of pixels into the texture and returns the bytes uploaded. When most of the
+// frame changed, one full upload is cheaper than many small ones.
+size_t upload_tiles(SDL_Texture* texture, const vector<uint8_t>& pixels, const vector<tile_scheduler::tile>& tiles) {
+	size_t dirty_pixels = 0;
+	for (const auto& t : tiles)
+		dirty_pixels += t.pixel_count();
+	if (dirty_pixels == 0)
+		return 0;
+
+	if (dirty_pixels * 2 > size_t(image_width) * image_height) {
+		SDL_UpdateTexture(texture, NULL, pixels.data(), image_width * 4);
+		return pixels.size();
+	}
+
+	for (const auto& t : tiles) {
+		SDL_Rect rect = { t.x0, t.y0, t.width(), t.height() };
+		SDL_UpdateTexture(texture, &rect, &pixels[(size_t(t.y0) * image_width + t.x0) * 4], image_width * 4);
+	}
+	return dirty_pixels * 4;
+}
+
+camera build_scene(const render_options& options) {
+	auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
+	auto material_center = make_shared<lambertian>(color(0.7, 0.3, 0.3));
+	auto material_left   = make_shared<metal>(color(0.8, 0.8, 0.8), 0.3);
+	auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 1.0);
+
+	scene.add(make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
+	scene.add(make_shared<sphere>(point3( 0.0,    0.0, -1.0),   0.5, material_center));
+	scene.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.5, material_left));
+	scene.add(make_shared<sphere>(point3( 1.0,    0.0, -1.0),   0.5, material_right));
+
+	// Optional field of small spheres resting on the ground, for testing large scenes. They are kept
+	// in one SoA sphere set rather than as individual sphere objects.
+	auto sphere_field = make_shared<sphere_set>();
+	seed_random(0, 0);
+	for (int i = 0; i < options.random_spheres; i++) {
+		const real radius = real(random_double(0.02, 0.1));
+		const real x = real(random_double(-10, 10));
+		const real z = real(random_double(-1.5, 15));
+		const real y = real(-100.5 + sqrt((100.0 + radius) * (100.0 + radius) - x * x - (z + 1.0) * (z + 1.0)));
+
+		shared_ptr<material> sphere_material;
+		if (random_double() < 0.7)
+			sphere_material = make_shared<lambertian>(color::random() * color::random());
+		else
+			sphere_material = make_shared<metal>(color::random(0.5, 1), real(random_double(0, 0.5)));
+		sphere_field->add(point3(x, y, z), radius, sphere_material);
 	}
+	if (sphere_field->size() > 0) {
+		sphere_field->build();
+		scene.add(sphere_field);
+	}
+
+	// Wrap the scene in a bounding volume hierarchy so hit tests scale with log(object count)
+	scene = hittable_list(make_shared<bvh_node>(scene));
+
+	const auto aspect_ratio = real(image_width) / image_height;
+	return camera(vec3(0, 1, -2), -vec3(0, -1, 1), 90.0, aspect_ratio);
 }
 
 int main(int argc, char** args) {
+	render_options options;
+	if (!parse_options(argc, args, options))
+		return 1;
+
+
+	image_width = options.width;
+	image_height = options.height;
+	roulette = options.roulette;
+	packet_tracing = options.packet_tracing;
+	wavefront = options.wavefront;
+	sampling = options.sampler;
+	if (sampling == sampler_kind::blue_noise)
+		blue_noise_mask(); // Build the mask now rather than in the first render jobs
+
+	// Scene definition
+	camera cam = build_scene(options);
+
+	if (!options.benchmark.empty())
+		return run_benchmark(options.benchmark, scene, cam, image_width, image_height);
+
+	if (options.headless)
+		return render_headless(options, cam);
+
 	bool image_buffer_dirty = false;
+	bool keep_history = true; // Whether the next restart may reproject the accumulated image
 
-	future<void> render_futures[batch_count] = {};
+	thread_pool pool(options.threads);
+	tile_scheduler tiles(image_width, image_height, tile_size);
 	vector<uint8_t> pixels(image_width * image_height * 4, 0);
-	color* color_sums = new color[image_width * image_height];
-	uint32_t* pixel_sample_counts = new uint32_t[image_width * image_height];
-
-	int batches_dispatched = 0;
-	clear_color_sums(color_sums, pixel_sample_counts);
+	accumulation_buffer accumulation(image_width, image_height);
+	accumulation.reset(tiles, options.preview_block);
+	// The denoiser's planes take about 57 MB at 720p, so it is only built once it is first enabled
+	std::unique_ptr<denoiser> filter;
+	bool denoise = false;
+	auto enable_denoiser = [&](bool enable) {
+		denoise = enable;
+		if (denoise && !filter)
+			filter = std::make_unique<denoiser>(image_width, image_height, pool);
+		accumulation.set_denoiser(denoise ? filter.get() : nullptr);
+	};
+	enable_denoiser(options.denoise);
+
+	size_t next_tile = 0;
+	tonemap_settings tonemap = options.tonemap;
+	bool show_density = false;
 
 	SDL_Event ev;
 	bool running = true;
@@ -146,7 +655,8 @@ int main(int argc, char** args) {
 		return 1;
 	}
 
-	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+	// No vsync: frame_pacer sets the display rate, so present never blocks the loop
+	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
 	if (!renderer) {
 		std::cout << "Error creating renderer: " << SDL_GetError() << std::endl;
 		system("pause");
@@ -160,62 +670,17 @@ int main(int argc, char** args) {
 		return 1;
 	}
 
-	// Scene definition
-	auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-	auto material_center = make_shared<lambertian>(color(0.7, 0.3, 0.3));
-	auto material_left   = make_shared<metal>(color(0.8, 0.8, 0.8), 0.3);
-	auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 1.0);
-
-	scene.add(make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
-	scene.add(make_shared<sphere>(point3( 0.0,    0.0, -1.0),   0.5, material_center));
-	scene.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.5, material_left));
-	scene.add(make_shared<sphere>(point3( 1.0,    0.0, -1.0),   0.5, material_right));
+	std::vector<tile_scheduler::tile> resolved_tiles;
 
-	// Camera
-	camera cam = camera(vec3(0, 1, -2), -vec3(0, -1, 1), 90.0, aspect_ratio);
+	// Workers read this copy, which only changes while the pool is idle
+	camera render_cam = cam;
 
-	// Initialize render futures array
-	for (int i = 0; i < batch_count; i++) {
-		render_futures[i] = std::async(std::launch::async, render_pixels, cam, std::ref(color_sums), std::ref(pixel_sample_counts), std::ref(pixels), batches_dispatched * batch_size, batch_size);
-		batches_dispatched++;
-	}
-
-	// Main rendering loop
+	// Main loop. It runs at the pacer's rate: input, restarting stale work, topping up the pool, then
+	// resolving and presenting. Workers render flat out in between.
+	frame_pacer pacer(options.frame_rate);
+	size_t uploaded_bytes = 0;
 	while (running) {
-		uint64_t start = SDL_GetPerformanceCounter();
-
-		// If image buffer is dirty, clear pixel arrays and wait for all old render threads to complete
-		// TODO: we should interrupt threads that are no longer relevant instead of having to wait for them to finish
-		if (image_buffer_dirty) {
-			wait_for_render_threads(render_futures);
-			clear_color_sums(color_sums, pixel_sample_counts);
-			batches_dispatched = 0;
-			image_buffer_dirty = false;
-		}
-
-		// Render pixel colors into array
-		for (int i = 0; i < batch_count; i++) {
-			if (render_futures[i].valid()) {
-				// Check if each render thread has completed; if so, launch another in its place
-				const auto fs = render_futures[i].wait_for(std::chrono::seconds(0));
-				if (fs == std::future_status::ready) {
-					render_futures[i].get();
-					render_futures[i] = std::async(std::launch::async, render_pixels, cam, std::ref(color_sums), std::ref(pixel_sample_counts), std::ref(pixels), batches_dispatched * batch_size, batch_size);
-					batches_dispatched++;
-				}
-			} else {
-				render_futures[i] = std::async(std::launch::async, render_pixels, cam, std::ref(color_sums), std::ref(pixel_sample_counts), std::ref(pixels), batches_dispatched * batch_size, batch_size);
-				batches_dispatched++;
-			}
-		}
-
-		// Push pixels to window surface
-		SDL_UpdateTexture(texture, NULL, pixels.data(), image_width * 4);
-		SDL_RenderCopy(renderer, texture, NULL, NULL);
-		SDL_RenderPresent(renderer);
-
-		uint64_t end = SDL_GetPerformanceCounter();
-		float delta = (end - start) / (float)SDL_GetPerformanceFrequency();
+		const double delta = pacer.begin_frame();
 
 		// Handle input events
 		while (SDL_PollEvent(&ev) != 0) {
@@ -228,7 +693,26 @@ int main(int argc, char** args) {
 					if (ev.key.keysym.sym == SDLK_n) {
 						render_normals = !render_normals;
 						image_buffer_dirty = true;
+						keep_history = false;
 					}
+					// T key - Cycle tonemap operators, -/= keys - Exposure down/up half a stop. Only
+					// the resolve changes, so the accumulated samples are kept.
+					if (ev.key.keysym.sym == SDLK_t) {
+						tonemap.op = static_cast<tonemap_operator>((static_cast<int>(tonemap.op) + 1) % 3);
+						accumulation.mark_unresolved();
+					}
+					if (ev.key.keysym.sym == SDLK_MINUS || ev.key.keysym.sym == SDLK_EQUALS) {
+						tonemap.exposure += ev.key.keysym.sym == SDLK_MINUS ? -0.5f : 0.5f;
+						accumulation.mark_unresolved();
+					}
+					// V key - Toggle showing how many samples each tile has taken
+					if (ev.key.keysym.sym == SDLK_v) {
+						show_density = !show_density;
+						accumulation.show_sample_density(show_density);
+					}
+					// F key - Toggle the denoiser
+					if (ev.key.keysym.sym == SDLK_f)
+						enable_denoiser(!denoise);
 			}
 		}
 
@@ -258,18 +742,73 @@ int main(int argc, char** args) {
 			image_buffer_dirty = true;
 		}
 
-		char title[16];
-		sprintf_s(title, "%f", 1.0f / delta);
-		SDL_SetWindowTitle(window, title);
+		// If image buffer is dirty, cancel stale tiles, then reproject or clear the accumulated samples.
+		// Tiles already running notice the new generation before their next pixel row; if they still have
+		// not stopped within the wait budget, the restart is retried next frame rather than stalling the
+		// display.
+		if (image_buffer_dirty) {
+			render_generation++;
+			pool.cancel_pending();
+			if (pool.wait_idle_for(restart_wait_frames * pacer.get_frame_interval())) {
+				tiles.release_all();
+				tiles.split_expensive_tiles(tile_split_factor);
+				if (keep_history && options.history_limit > 0)
+					accumulation.reproject(cam, tiles, pool, options.preview_block, float(options.history_limit));
+				else
+					accumulation.reset(tiles, options.preview_block);
+				render_cam = cam;
+				next_tile = 0;
+				image_buffer_dirty = false;
+				keep_history = true;
+			}
+		}
+
+		// Keep the pool topped up with tiles to render, skipping any tile a worker still owns or whose
+		// error estimate is below the threshold. The queue holds enough work to keep every worker busy
+		// until the next top-up and then some; once every tile has converged, the workers go idle.
+		const size_t job_limit = queued_job_limit(pacer, pool.size());
+		const uint32_t generation = render_generation.load();
+		for (size_t attempts = 0; attempts < tiles.tile_count() && pool.pending() < job_limit && !image_buffer_dirty; attempts++) {
+			const size_t tile_index = next_tile;
+			next_tile = (next_tile + 1) % tiles.tile_count();
+			if (accumulation.error(tile_index) < options.error_threshold || !tiles.try_acquire(tile_index))
+				continue;
+
+			pool.submit([&render_cam, &accumulation, &tiles, tile_index, generation] {
+				render_tile(render_cam, accumulation, tiles, tile_index, generation);
+			});
+		}
+
+		// Resolve the tiles that gained samples since the last frame and upload just those
+		accumulation.resolve(pixels, tonemap, resolved_tiles);
+		uploaded_bytes += upload_tiles(texture, pixels, resolved_tiles);
+		SDL_RenderCopy(renderer, texture, NULL, NULL);
+		SDL_RenderPresent(renderer);
+
+		if (pacer.end_frame(pool)) {
+			const auto& stats = pacer.get_stats();
+			const auto pool_stats = pool.get_stats();
+			size_t deepest_queue = 0;
+			for (unsigned int i = 0; i < pool.size(); i++)
+				deepest_queue = std::max(deepest_queue, pool.queue_depth(i));
+			char title[256];
+			sprintf_s(title, "%.1f fps | main %.2f ms (%.0f%%) | workers %.0f%% | queued %zu (limit %zu, deepest %zu) | active %zu | steals %llu | %s %+.1f EV | upload %.0f KB/s",
+			          stats.frame_rate, stats.main_seconds * 1e3, stats.main_fraction * 100, stats.worker_fraction * 100,
+			          pool_stats.queued, job_limit, deepest_queue, pool_stats.active, static_cast<unsigned long long>(pool_stats.steals),
+			          tonemap_name(tonemap.op), tonemap.exposure, uploaded_bytes / 1024.0 / stats.interval_seconds);
+			SDL_SetWindowTitle(window, title);
+			uploaded_bytes = 0;
+		}
 	}
 
+	render_generation++;
+	pool.cancel_pending();
+	pool.wait_idle();
+
 	// Clean up SDL
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 
-	delete[] color_sums;
-	delete[] pixel_sample_counts;
-
 	return 0;
 }
@@ -2,46 +2,71 @@
 
 #include "toytracer.h"
 #include "hittable.h"
+#include "onb.h"
+#include "sampler.h"
 
 struct hit_result;
 
+// Built-in material types, used to group hits that run the same scatter code. Materials that are
+// not one of the built-in types are grouped as other and shaded through their virtual scatter.
+enum class material_kind : uint8_t { lambertian, metal, other };
+constexpr int material_kind_count = 3;
+
 class material {
 	public:
-		virtual bool scatter(const ray& r_in, const hit_result& result, color& attenuation, ray& scattered) const = 0;
+		// Draws the scattered direction from s, starting at the current bounce's first dimension
+		virtual bool scatter(const ray& r_in, const hit_result& result, sampler& s, color& attenuation, ray& scattered) const = 0;
+		virtual material_kind kind() const { return material_kind::other; }
+		// Overall surface color, which guides the denoiser. White keeps a material's texture in the
+		// filtered color, which is safe for any material that doesn't say otherwise.
+		virtual color surface_albedo() const { return color(1, 1, 1); }
 };
 
+// Scatter functions shared by the material classes and the tagged scene representation
+
+inline bool lambertian_scatter(const color& albedo, const hit_result& result, sampler& s, color& attenuation, ray& scattered) {
+	// Cosine weighted about the normal, which is exactly the Lambertian lobe
+	const sample2 d = s.get_2d();
+	scattered = ray(result.p, onb(result.normal).local(sample_cosine_hemisphere(d.u, d.v)));
+	attenuation = albedo;
+	return true;
+}
+
+inline bool metal_scatter(const color& albedo, real roughness, const ray& r_in, const hit_result& result, sampler& s, color& attenuation, ray& scattered) {
+	vec3 reflected = reflect(unit_vector(r_in.direction()), result.normal);
+	const sample2 d = s.get_2d();
+	scattered = ray(result.p, reflected + roughness * sample_in_unit_sphere(d.u, d.v, s.get_1d()));
+	attenuation = albedo;
+	return (dot(scattered.direction(), result.normal) > 0);
+}
+
 class lambertian : public material {
 	public:
 		lambertian(const color& a) : albedo(a) {}
 
-		virtual bool scatter(const ray& r_in, const hit_result& result, color& attenuation, ray& scattered) const override {
-			auto scatter_direction = result.normal + random_unit_vector();
-			
-			// Catch degenerate scatter direction
-			if (scatter_direction.near_zero())
-				scatter_direction = result.normal;
-
-			scattered = ray(result.p, scatter_direction);
-			attenuation = albedo;
-			return true;
+		virtual bool scatter(const ray& r_in, const hit_result& result, sampler& s, color& attenuation, ray& scattered) const override {
+			return lambertian_scatter(albedo, result, s, attenuation, scattered);
 		}
 
+		virtual material_kind kind() const override { return material_kind::lambertian; }
+		virtual color surface_albedo() const override { return albedo; }
+
 	public:
 		color albedo;
 };
 
 class metal : public material {
 	public:
-		metal(const color& a, double r) : albedo(a), roughness(r < 1 ? r : 1) {}
+		metal(const color& a, real r) : albedo(a), roughness(r < 1 ? r : 1) {}
 
-		virtual bool scatter(const ray& r_in, const hit_result& result, color& attenuation, ray& scattered) const override {
-			vec3 reflected = reflect(unit_vector(r_in.direction()), result.normal);
-			scattered = ray(result.p, reflected + roughness * random_in_unit_sphere());
-			attenuation = albedo;
-			return (dot(scattered.direction(), result.normal) > 0);
+		virtual bool scatter(const ray& r_in, const hit_result& result, sampler& s, color& attenuation, ray& scattered) const override {
+			return metal_scatter(albedo, roughness, r_in, result, s, attenuation, scattered);
 		}
 
+		virtual material_kind kind() const override { return material_kind::metal; }
+		virtual color surface_albedo() const override { return albedo; }
+
 	public:
 		color albedo;
-		double roughness;
+		real roughness;
 };
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "toytracer.h"
+
+// Orthonormal basis around a unit vector w, built without branches (Duff et al. 2017), for turning
+// directions sampled around +z into world space
+class onb {
+	public:
+		onb(const vec3& n) : axis_w(n) {
+			const real sign = real(std::copysign(1.0, double(n.z())));
+			const real a = real(-1) / (sign + n.z());
+			const real b = n.x() * n.y() * a;
+			axis_u = vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+			axis_v = vec3(b, sign + n.y() * n.y() * a, -n.y());
+		}
+
+		const vec3& u() const { return axis_u; }
+		const vec3& v() const { return axis_v; }
+		const vec3& w() const { return axis_w; }
+
+		vec3 local(const vec3& a) const {
+			return a.x() * axis_u + a.y() * axis_v + a.z() * axis_w;
+		}
+
+	private:
+		vec3 axis_u, axis_v, axis_w;
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "sampler.h"
+#include "tonemap.h"
+
+struct roulette_settings {
+	int start_depth = 3;            // Bounce from which paths may be terminated early
+	double min_probability = 0.05;  // Lower bound on the survival probability, limits variance from dim paths
+};
+
+struct render_options {
+	bool headless = false;
+	int width = 640*2;
+	int height = 360*2;
+	int samples_per_pixel = 64;     // Headless only; interactive mode accumulates until the camera moves
+	double frame_rate = 60.0;       // Interactive display and input rate; rendering runs independently
+	unsigned int threads = 0;       // 0 means one per hardware thread
+	std::string output = "render.png";
+	std::string benchmark;          // Runs the named microbenchmark instead of rendering
+	int random_spheres = 0;         // Extra small spheres scattered over the ground for large-scene tests
+	bool packet_tracing = true;
+	bool wavefront = false;         // Trace tiles a bounce at a time, shading hits grouped by material
+	int preview_block = 4;          // Interactive restarts begin with one sample per block of this many pixels square
+	float error_threshold = 0.004f; // Interactive tiles stop sampling once their estimated error is below this
+	bool denoise = false;           // Filter the image with the albedo and normal guided denoiser
+	int history_limit = 16;         // Samples' worth of reprojected history a pixel keeps on camera moves; 0 for none
+	sampler_kind sampler = sampler_kind::sobol;
+	roulette_settings roulette;
+	tonemap_settings tonemap;
+};
+
+void print_usage(const char* program) {
+	std::cout << "Usage: " << program << " [options]\n"
+	          << "  --headless          Render without a window and write the result to disk\n"
+	          << "  --width <pixels>    Image width (default 1280)\n"
+	          << "  --height <pixels>   Image height (default 720)\n"
+	          << "  --spp <samples>     Samples per pixel in headless mode (default 64)\n"
+	          << "  --threads <count>   Render threads (default: one per hardware thread)\n"
+	          << "  --fps <rate>        Interactive display rate in frames per second (default 60)\n"
+	          << "  --preview <pixels>  Block size of the low resolution passes after the camera moves,\n"
+	          << "                      a power of two; 1 disables them (default 4)\n"
+	          << "  --denoise           Filter the image with the albedo and normal guided denoiser\n"
+	          << "  --error <threshold> Estimated display error at which a tile stops taking samples, where\n"
+	          << "                      1/255 is one 8-bit step; 0 never stops (default 0.004)\n"
+	          << "  --history <samples> Most samples a pixel carries over when the camera moves; 0 clears\n"
+	          << "                      the image instead (default 16)\n"
+	          << "  --output <path>     Output image, .ppm, .png or .pfm (default render.png)\n"
+	          << "  --rr-depth <bounce> First bounce Russian roulette may end a path at (default 3)\n"
+	          << "  --rr-min <p>        Minimum path survival probability (default 0.05)\n"
+	          << "  --exposure <stops>  Exposure adjustment applied before tonemapping (default 0)\n"
+	          << "  --tonemap <name>    Tonemap operator: clamp, reinhard or aces (default clamp)\n"
+	          << "  --sampler <name>    Sample sequence: independent, sobol, halton or blue\n"
+	          << "                      (default sobol)\n"
+	          << "  --spheres <count>   Scatter this many extra small spheres over the ground\n"
+	          << "  --no-packets        Trace primary rays one at a time instead of in packets\n"
+	          << "  --wavefront         Trace each tile a bounce at a time, shading hits grouped by material\n"
+	          << "  --bench <name>      Run a microbenchmark and exit (sphere, packets, dispatch, resolve,\n"
+	          << "                      scatter, rng)\n";
+}
+
+const int max_threads = 1024;
+const int max_image_size = 16384; // Largest width or height; keeps width * height * 4 bytes within an int
+
+// Whole-string conversions: trailing characters, an empty string, an out of range value or a
+// non-finite one fail instead of turning into 0 or a truncated number the way atoi and atof do
+inline bool parse_number(const char* text, int& value) {
+	char* end;
+	errno = 0;
+	const long parsed = strtol(text, &end, 10);
+	if (end == text || *end != '\0' || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+		return false;
+	value = int(parsed);
+	return true;
+}
+
+inline bool parse_number(const char* text, double& value) {
+	char* end;
+	errno = 0;
+	const double parsed = strtod(text, &end);
+	if (end == text || *end != '\0' || errno == ERANGE || !std::isfinite(parsed))
+		return false;
+	value = parsed;
+	return true;
+}
+
+inline bool parse_number(const char* text, float& value) {
+	double parsed;
+	if (!parse_number(text, parsed))
+		return false;
+	value = static_cast<float>(parsed);
+	return true;
+}
+
+bool parse_options(int argc, char** args, render_options& options) {
+	int threads = 0;
+	bool threads_given = false;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = args[i];
+		const bool has_value = i + 1 < argc;
+
+		// Reads the option's value into value, or reports it and returns false
+		auto number = [&](auto& value) {
+			if (parse_number(args[++i], value))
+				return true;
+			std::cout << "Invalid value for " << arg << ": " << args[i] << std::endl;
+			return false;
+		};
+
+		if (strcmp(arg, "--headless") == 0) {
+			options.headless = true;
+		} else if (strcmp(arg, "--width") == 0 && has_value) {
+			if (!number(options.width))
+				return false;
+		} else if (strcmp(arg, "--height") == 0 && has_value) {
+			if (!number(options.height))
+				return false;
+		} else if (strcmp(arg, "--spp") == 0 && has_value) {
+			if (!number(options.samples_per_pixel))
+				return false;
+		} else if (strcmp(arg, "--threads") == 0 && has_value) {
+			if (!number(threads))
+				return false;
+			threads_given = true;
+		} else if (strcmp(arg, "--fps") == 0 && has_value) {
+			if (!number(options.frame_rate))
+				return false;
+		} else if (strcmp(arg, "--preview") == 0 && has_value) {
+			if (!number(options.preview_block))
+				return false;
+		} else if (strcmp(arg, "--denoise") == 0) {
+			options.denoise = true;
+		} else if (strcmp(arg, "--error") == 0 && has_value) {
+			if (!number(options.error_threshold))
+				return false;
+		} else if (strcmp(arg, "--history") == 0 && has_value) {
+			if (!number(options.history_limit))
+				return false;
+		} else if (strcmp(arg, "--output") == 0 && has_value) {
+			options.output = args[++i];
+		} else if (strcmp(arg, "--spheres") == 0 && has_value) {
+			if (!number(options.random_spheres))
+				return false;
+		} else if (strcmp(arg, "--no-packets") == 0) {
+			options.packet_tracing = false;
+		} else if (strcmp(arg, "--wavefront") == 0) {
+			options.wavefront = true;
+		} else if (strcmp(arg, "--bench") == 0 && has_value) {
+			options.benchmark = args[++i];
+		} else if (strcmp(arg, "--rr-depth") == 0 && has_value) {
+			if (!number(options.roulette.start_depth))
+				return false;
+		} else if (strcmp(arg, "--rr-min") == 0 && has_value) {
+			if (!number(options.roulette.min_probability))
+				return false;
+		} else if (strcmp(arg, "--exposure") == 0 && has_value) {
+			if (!number(options.tonemap.exposure))
+				return false;
+		} else if (strcmp(arg, "--tonemap") == 0 && has_value) {
+			if (!parse_tonemap(args[++i], options.tonemap.op)) {
+				std::cout << "Unknown tonemap operator: " << args[i] << " (use clamp, reinhard or aces)" << std::endl;
+				return false;
+			}
+		} else if (strcmp(arg, "--sampler") == 0 && has_value) {
+			if (!parse_sampler(args[++i], options.sampler)) {
+				std::cout << "Unknown sampler: " << args[i] << " (use independent, sobol, halton or blue)" << std::endl;
+				return false;
+			}
+		} else {
+			std::cout << "Unknown or incomplete option: " << arg << std::endl;
+			print_usage(args[0]);
+			return false;
+		}
+	}
+
+	if (options.width < 2 || options.height < 2 || options.samples_per_pixel < 1) {
+		std::cout << "Width and height must be at least 2 and spp at least 1" << std::endl;
+		return false;
+	}
+
+	if (options.width > max_image_size || options.height > max_image_size) {
+		std::cout << "Width and height must be at most " << max_image_size << std::endl;
+		return false;
+	}
+
+	if (threads_given) {
+		if (threads < 1 || threads > max_threads) {
+			std::cout << "Thread count must be between 1 and " << max_threads << std::endl;
+			return false;
+		}
+		options.threads = static_cast<unsigned int>(threads);
+	}
+
+	if (options.frame_rate <= 0.0) {
+		std::cout << "Frame rate must be positive" << std::endl;
+		return false;
+	}
+
+	if (options.random_spheres < 0) {
+		std::cout << "Sphere count must not be negative" << std::endl;
+		return false;
+	}
+
+	if (options.preview_block < 1 || (options.preview_block & (options.preview_block - 1)) != 0) {
+		std::cout << "Preview block size must be a power of two" << std::endl;
+		return false;
+	}
+
+	if (options.error_threshold < 0.0f) {
+		std::cout << "Error threshold must not be negative" << std::endl;
+		return false;
+	}
+
+	if (options.history_limit < 0) {
+		std::cout << "History limit must not be negative" << std::endl;
+		return false;
+	}
+
+	if (options.roulette.min_probability <= 0.0 || options.roulette.min_probability > 1.0) {
+		std::cout << "Russian roulette minimum probability must be in (0, 1]" << std::endl;
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "toytracer.h"
+
+// Packet width follows the widest vector unit the build targets: 8 lanes with AVX, 4 with SSE.
+// Lane loops below are written branch-free over fixed-size arrays so they compile to SIMD code.
+#if defined(__AVX__)
+constexpr int packet_width = 8;
+#else
+constexpr int packet_width = 4;
+#endif
+
+// Structure-of-arrays bundle of coherent rays, e.g. primary rays of neighboring pixels
+struct ray_packet {
+	alignas(32) real ox[packet_width];
+	alignas(32) real oy[packet_width];
+	alignas(32) real oz[packet_width];
+	alignas(32) real dx[packet_width];
+	alignas(32) real dy[packet_width];
+	alignas(32) real dz[packet_width];
+	alignas(32) real inv_dx[packet_width];
+	alignas(32) real inv_dy[packet_width];
+	alignas(32) real inv_dz[packet_width];
+	int lane_count = 0;
+
+	void set_lane(int lane, const ray& r) {
+		ox[lane] = r.orig.x(); oy[lane] = r.orig.y(); oz[lane] = r.orig.z();
+		dx[lane] = r.dir.x(); dy[lane] = r.dir.y(); dz[lane] = r.dir.z();
+		inv_dx[lane] = 1 / dx[lane]; inv_dy[lane] = 1 / dy[lane]; inv_dz[lane] = 1 / dz[lane];
+	}
+
+	// Unused lanes get a zero ray; their hit interval is emptied by packet_hit::reset
+	void pad() {
+		for (int lane = lane_count; lane < packet_width; lane++)
+			set_lane(lane, ray(point3(0, 0, 0), vec3(1, 1, 1)));
+	}
+
+	ray get_ray(int lane) const {
+		return ray(point3(ox[lane], oy[lane], oz[lane]), vec3(dx[lane], dy[lane], dz[lane]));
+	}
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+// Scalar type of the math core. Defining TOYTRACER_FLOAT builds a single precision renderer.
+#if defined(TOYTRACER_FLOAT)
+using real = float;
+#else
+using real = double;
+#endif
+
+// Thresholds that have to scale with the precision the renderer is built in
+template <typename T> struct precision_traits;
+
+template <> struct precision_traits<double> {
+	// Minimum hit distance, so scattered rays don't re-hit the surface they leave from
+	static constexpr double self_intersection_epsilon = 0.001;
+	// Below this in every component a scatter direction counts as degenerate
+	static constexpr double near_zero_threshold = 1e-8;
+};
+
+template <> struct precision_traits<float> {
+	// Hit points carry roughly 1e-7 relative error, which on the 100 unit ground sphere is near 1e-5
+	static constexpr float self_intersection_epsilon = 0.002f;
+	static constexpr float near_zero_threshold = 1e-5f;
+};
+
+constexpr real self_intersection_epsilon = precision_traits<real>::self_intersection_epsilon;
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+
+// The generator behind random_double() is picked at compile time by defining one of:
+//   TOYTRACER_RNG_PCG32         - PCG-XSH-RR 32-bit output (default)
+//   TOYTRACER_RNG_XOSHIRO256P   - xoshiro256+
+//   TOYTRACER_RNG_RDRAND        - hardware RDRAND; ignores seeding, so renders are not reproducible
+#if !defined(TOYTRACER_RNG_PCG32) && !defined(TOYTRACER_RNG_XOSHIRO256P) && !defined(TOYTRACER_RNG_RDRAND)
+#define TOYTRACER_RNG_PCG32
+#endif
+
+#ifdef TOYTRACER_RNG_RDRAND
+#include <immintrin.h>
+#endif
+
+inline uint64_t splitmix64(uint64_t& state) {
+	uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+class pcg32 {
+	public:
+		pcg32() { seed(0x853c49e6748fea9bull, 0xda3e39cb94b95bdbull); }
+
+		void seed(uint64_t init_state, uint64_t init_sequence) {
+			state = 0;
+			inc = (init_sequence << 1) | 1;
+			next_uint32();
+			state += init_state;
+			next_uint32();
+		}
+
+		uint32_t next_uint32() {
+			uint64_t old_state = state;
+			state = old_state * 6364136223846793005ull + inc;
+			uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+			uint32_t rot = static_cast<uint32_t>(old_state >> 59);
+			return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+		}
+
+		double next_double() {
+			// 32 random bits scaled into [0,1)
+			return next_uint32() * (1.0 / 4294967296.0);
+		}
+
+	private:
+		uint64_t state;
+		uint64_t inc;
+};
+
+class xoshiro256p {
+	public:
+		xoshiro256p() { seed(0x853c49e6748fea9bull, 0xda3e39cb94b95bdbull); }
+
+		void seed(uint64_t init_state, uint64_t init_sequence) {
+			uint64_t sm = init_state ^ (init_sequence * 0x9e3779b97f4a7c15ull);
+			for (auto& word : s)
+				word = splitmix64(sm);
+		}
+
+		uint64_t next_uint64() {
+			const uint64_t result = s[0] + s[3];
+			const uint64_t t = s[1] << 17;
+
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+			s[2] ^= t;
+			s[3] = (s[3] << 45) | (s[3] >> 19);
+
+			return result;
+		}
+
+		double next_double() {
+			// Top 53 bits are the well-mixed ones for the + scrambler
+			return (next_uint64() >> 11) * (1.0 / 9007199254740992.0);
+		}
+
+	private:
+		uint64_t s[4];
+};
+
+#ifdef TOYTRACER_RNG_RDRAND
+// Hardware entropy, kept for comparison. It cannot be seeded, so renders are not reproducible and
+// packet, single-ray and wavefront tracing no longer give the same image.
+class rdrand_rng {
+	public:
+		void seed(uint64_t, uint64_t) {}
+
+		double next_double() {
+			uint32_t a;
+			while (!_rdrand32_step(&a)) {} // Fails only transiently when the entropy source is drained
+			return a * (1.0 / 4294967296.0);
+		}
+};
+#endif
+
+#if defined(TOYTRACER_RNG_RDRAND)
+using default_rng = rdrand_rng;
+#elif defined(TOYTRACER_RNG_XOSHIRO256P)
+using default_rng = xoshiro256p;
+#else
+using default_rng = pcg32;
+#endif
+
+inline default_rng& thread_rng() {
+	thread_local default_rng rng;
+	return rng;
+}
+
+inline void seed_random(uint64_t pixel_index, uint64_t sample_index) {
+	// Seeding per pixel and sample makes a render independent of which thread traced what
+	uint64_t sm = (pixel_index << 32) ^ sample_index;
+	thread_rng().seed(splitmix64(sm), pixel_index);
+}
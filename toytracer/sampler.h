@@ -0,0 +1,230 @@
+#pragma once
+
+#include "toytracer.h"
+
+#include "blue_noise.h"
+
+#include <cstdint>
+#include <string>
+
+// Per pixel sample generator. A path asks it for numbers dimension by dimension: the pixel jitter
+// first, then a fixed block of dimensions per bounce (see bounce_dimension), so the same dimension
+// always feeds the same decision and low-discrepancy sequences stay stratified where it matters.
+//
+//   independent - uniform random numbers from the thread generator's algorithm, seeded per sample
+//   sobol       - Sobol (0,2)-sequence padded pair by pair: each dimension pair shuffles the sample
+//                 index and Owen scrambles both coordinates, hashed from the pixel and dimension
+//                 (Burley 2020), so every pair is a well stratified net that differs per pixel
+//   halton      - Halton, one prime base per dimension, with a Cranley-Patterson rotation per pixel
+//                 and dimension; dimensions past the prime table fall back to hashed random numbers
+//   blue        - one Owen scrambled Sobol sequence shared by every pixel, rotated per pixel by a
+//                 blue-noise mask (Georgiev and Fajardo 2016). Each dimension reads the mask at its own
+//                 offset, and successive samples step along the sequence, so every pass is a fresh
+//                 rotation. Neighboring pixels' errors then differ at high frequencies only, which
+//                 looks far cleaner at a few samples per pixel and filters away in the denoiser.
+
+enum class sampler_kind { independent, sobol, halton, blue_noise };
+
+inline const char* sampler_name(sampler_kind kind) {
+	switch (kind) {
+		case sampler_kind::sobol: return "sobol";
+		case sampler_kind::halton: return "halton";
+		case sampler_kind::blue_noise: return "blue";
+		default: return "independent";
+	}
+}
+
+inline bool parse_sampler(const std::string& name, sampler_kind& kind) {
+	for (auto candidate : { sampler_kind::independent, sampler_kind::sobol, sampler_kind::halton, sampler_kind::blue_noise }) {
+		if (name == sampler_name(candidate)) {
+			kind = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Dimensions 0 and 1 jitter the sample within its pixel. Each bounce then has four: two for the
+// scatter direction, one more the material may use, and one for Russian roulette.
+const int pixel_dimensions = 2;
+const int bounce_dimensions = 4;
+const int roulette_dimension = 3; // Offset within a bounce's block
+
+inline int bounce_dimension(int depth) {
+	return pixel_dimensions + depth * bounce_dimensions;
+}
+
+struct sample2 {
+	double u, v;
+};
+
+inline uint32_t hash_uint32(uint32_t x) {
+	// Chris Wellons' lowbias32
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t value) {
+	return hash_uint32(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// Owen scrambling of a 32-bit fraction: each bit is flipped based on a hash of the bits above it.
+// Laine and Karras' hash does this for the low bits of an integer, hence the reversals.
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+	x = reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverse_bits(x);
+}
+
+// First two dimensions of the Sobol sequence, as 32-bit fractions
+inline uint32_t sobol_dimension0(uint32_t index) {
+	return reverse_bits(index);
+}
+
+// The second dimension XORs one direction number per set index bit. Scrambled indices have bits set
+// all the way up, so the direction numbers are combined a byte at a time from a table.
+inline uint32_t sobol_dimension1(uint32_t index) {
+	struct byte_table {
+		uint32_t entries[4][256];
+		byte_table() {
+			uint32_t directions[32];
+			directions[0] = 1u << 31;
+			for (int bit = 1; bit < 32; bit++)
+				directions[bit] = directions[bit - 1] ^ (directions[bit - 1] >> 1);
+			for (int byte = 0; byte < 4; byte++) {
+				for (uint32_t value = 0; value < 256; value++) {
+					uint32_t result = 0;
+					for (int bit = 0; bit < 8; bit++) {
+						if (value & (1u << bit))
+							result ^= directions[byte * 8 + bit];
+					}
+					entries[byte][value] = result;
+				}
+			}
+		}
+	};
+	static const byte_table table;
+	return table.entries[0][index & 0xff] ^ table.entries[1][(index >> 8) & 0xff] ^
+	       table.entries[2][(index >> 16) & 0xff] ^ table.entries[3][index >> 24];
+}
+
+inline double radical_inverse(uint32_t base, uint32_t index) {
+	const double inv_base = 1.0 / base;
+	double scale = inv_base;
+	double result = 0.0;
+	while (index != 0) {
+		result += (index % base) * scale;
+		index /= base;
+		scale *= inv_base;
+	}
+	return result;
+}
+
+inline double uint32_to_unit(uint32_t x) {
+	return x * (1.0 / 4294967296.0);
+}
+
+class sampler {
+	public:
+		sampler(sampler_kind kind = sampler_kind::independent) : kind(kind) {}
+
+		// Starts the given sample of pixel (x, y) at dimension 0
+		void start(int x, int y, uint32_t sample_index) {
+			pixel_x = x;
+			pixel_y = y;
+			pixel_seed = hash_combine(hash_uint32(uint32_t(x)), uint32_t(y));
+			index = sample_index;
+			dimension = 0;
+			if (kind == sampler_kind::independent) {
+				const uint64_t pixel_key = (uint64_t(uint32_t(y)) << 32) | uint32_t(x);
+				uint64_t sm = pixel_key ^ (uint64_t(sample_index) << 16);
+				rng.seed(splitmix64(sm), pixel_key);
+			}
+		}
+
+		void set_dimension(int d) { dimension = d; }
+
+		double get_1d() {
+			const int d = dimension++;
+			switch (kind) {
+				case sampler_kind::sobol:
+					// A 1D dimension is the first coordinate of its own padded pair
+					return uint32_to_unit(sobol_0(hash_combine(pixel_seed, uint32_t(d))));
+				case sampler_kind::blue_noise:
+					return rotate(uint32_to_unit(sobol_0(hash_uint32(uint32_t(d)))), d);
+				case sampler_kind::halton:
+					return halton(d);
+				default:
+					return rng.next_double();
+			}
+		}
+
+		sample2 get_2d() {
+			if (kind != sampler_kind::sobol && kind != sampler_kind::blue_noise) {
+				const double u = get_1d();
+				return { u, get_1d() };
+			}
+
+			const int d = dimension;
+			dimension += 2;
+			const uint32_t seed = kind == sampler_kind::blue_noise ? hash_uint32(uint32_t(d)) : hash_combine(pixel_seed, uint32_t(d));
+			const uint32_t shuffled = owen_scramble(index, seed);
+			const sample2 sample = {
+				uint32_to_unit(owen_scramble(sobol_dimension0(shuffled), hash_uint32(seed))),
+				uint32_to_unit(owen_scramble(sobol_dimension1(shuffled), hash_uint32(seed ^ 0x5bd1e995u))) };
+			if (kind == sampler_kind::blue_noise)
+				return { rotate(sample.u, d), rotate(sample.v, d + 1) };
+			return sample;
+		}
+
+	private:
+		sampler_kind kind;
+		int pixel_x = 0;
+		int pixel_y = 0;
+		uint32_t pixel_seed = 0;
+		uint32_t index = 0;
+		int dimension = 0;
+		default_rng rng;
+
+		// First coordinate of the current sample in the scrambled Sobol pair with the given seed
+		uint32_t sobol_0(uint32_t seed) const {
+			return owen_scramble(sobol_dimension0(owen_scramble(index, seed)), hash_uint32(seed));
+		}
+
+		// Cranley-Patterson rotation by the blue-noise mask, read at an offset per dimension so the
+		// dimensions' rotations are uncorrelated
+		double rotate(double value, int d) const {
+			const uint32_t offset = hash_uint32(uint32_t(d) + 0x68e31da4u);
+			const double rotated = value + blue_noise(pixel_x + int(offset & 0xffff), pixel_y + int(offset >> 16));
+			return rotated < 1.0 ? rotated : rotated - 1.0;
+		}
+
+		double halton(int d) const {
+			static const uint32_t primes[] = {
+				2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71,
+				73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151 };
+			const uint32_t seed = hash_combine(pixel_seed, uint32_t(d));
+			if (d >= int(sizeof(primes) / sizeof(primes[0])))
+				return uint32_to_unit(hash_combine(seed, index));
+
+			const double value = radical_inverse(primes[d], index) + uint32_to_unit(seed);
+			return value < 1.0 ? value : value - 1.0;
+		}
+};
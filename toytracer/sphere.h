@@ -6,18 +6,21 @@
 class sphere : public hittable {
 	public:
 		sphere() {}
-		sphere(point3 cen, double r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {};
-		sphere(point3 cen, double r) : center(cen), radius(r) {};
+		sphere(point3 cen, real r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {};
+		sphere(point3 cen, real r) : center(cen), radius(r) {};
 
-		virtual bool hit(const ray& r, double t_min, double t_max, hit_result& result) const override;
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_result& result) const override;
+		virtual bool bounding_box(aabb& output_box) const override;
+		virtual void hit_packet(const ray_packet& packet, real t_min, packet_hit& hits) const override;
 
 public:
 	point3 center;
-	double radius;
+	real radius;
 	shared_ptr<material> mat_ptr;
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_result& result) const {
+// Ray-sphere test shared by sphere and the tagged scene representation. Fills in everything but the material.
+inline bool hit_sphere(const point3& center, real radius, const ray& r, real t_min, real t_max, hit_result& result) {
 	vec3 oc = r.origin() - center;
 	auto a = r.direction().length_squared();
 	auto half_b = dot(oc, r.direction());
@@ -38,7 +41,62 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_result& result) c
 	result.p = r.at(root);
 	vec3 outward_normal = (result.p - center) / radius;
 	result.set_face_normal(r, outward_normal);
-	result.mat_ptr = mat_ptr;
 
 	return true;
 }
+
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_result& result) const {
+	if (!hit_sphere(center, radius, r, t_min, t_max, result))
+		return false;
+
+	result.mat_ptr = mat_ptr.get();
+	return true;
+}
+
+bool sphere::bounding_box(aabb& output_box) const {
+	output_box = aabb(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius));
+	return true;
+}
+
+void sphere::hit_packet(const ray_packet& packet, real t_min, packet_hit& hits) const {
+	// Solve the quadratic for every lane at once, then fill in full results only for lanes that hit
+	alignas(32) real roots[packet_width];
+	int lane_hits[packet_width];
+	int any_hit = 0;
+
+	for (int lane = 0; lane < packet_width; lane++) {
+		const real ocx = packet.ox[lane] - center.x();
+		const real ocy = packet.oy[lane] - center.y();
+		const real ocz = packet.oz[lane] - center.z();
+		const real a = packet.dx[lane] * packet.dx[lane] + packet.dy[lane] * packet.dy[lane] + packet.dz[lane] * packet.dz[lane];
+		const real half_b = ocx * packet.dx[lane] + ocy * packet.dy[lane] + ocz * packet.dz[lane];
+		const real c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+
+		const real discriminant = half_b * half_b - a * c;
+		const real sqrtd = sqrt(discriminant > 0 ? discriminant : real(0));
+		const real near_root = (-half_b - sqrtd) / a;
+		const real far_root = (-half_b + sqrtd) / a;
+		const real root = near_root >= t_min ? near_root : far_root;
+
+		roots[lane] = root;
+		lane_hits[lane] = discriminant >= 0 && root >= t_min && root <= hits.t[lane];
+		any_hit |= lane_hits[lane];
+	}
+
+	if (!any_hit)
+		return;
+
+	for (int lane = 0; lane < packet.lane_count; lane++) {
+		if (!lane_hits[lane])
+			continue;
+
+		const ray r = packet.get_ray(lane);
+		auto& result = hits.result[lane];
+		hits.t[lane] = roots[lane];
+		result.t = roots[lane];
+		result.p = r.at(roots[lane]);
+		vec3 outward_normal = (result.p - center) / radius;
+		result.set_face_normal(r, outward_normal);
+		result.mat_ptr = mat_ptr.get();
+	}
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "toytracer.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// Up to block_size spheres stored as structure-of-arrays. One ray is tested against the whole block
+// in a single branch-free loop, which AVX runs 4 (double) or 8 (float) spheres at a time.
+class sphere_block : public hittable {
+	public:
+		static const int block_size = 16;
+
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_result& result) const override;
+		virtual bool bounding_box(aabb& output_box) const override;
+
+	public:
+		alignas(32) real center_x[block_size] = {};
+		alignas(32) real center_y[block_size] = {};
+		alignas(32) real center_z[block_size] = {};
+		alignas(32) real radius[block_size] = {};
+		const material* materials[block_size] = {}; // Kept alive by the owning set
+		int count = 0;
+		aabb box;
+};
+
+// A large set of spheres that plugs into the scene as a single hittable. Spheres are grouped into
+// spatially coherent SoA blocks, and a bvh_node over the blocks keeps traversal logarithmic.
+class sphere_set : public hittable {
+	public:
+		sphere_set() {}
+
+		// A set holds a whole scene's worth of spheres, so it is shared rather than copied
+		sphere_set(const sphere_set&) = delete;
+		sphere_set& operator=(const sphere_set&) = delete;
+
+		void add(point3 center, real radius, shared_ptr<material> m);
+		// Groups the added spheres into blocks and builds the hierarchy; call once all spheres are added
+		void build();
+
+		size_t size() const { return centers.size(); }
+
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_result& result) const override;
+		virtual bool bounding_box(aabb& output_box) const override;
+		virtual void hit_packet(const ray_packet& packet, real t_min, packet_hit& hits) const override;
+
+	private:
+		std::vector<point3> centers;
+		std::vector<real> radii;
+		std::vector<uint32_t> material_ids;
+
+		// Material table; the shared pointers keep materials alive, the raw ones are read when shading
+		std::vector<shared_ptr<material>> owned_materials;
+		std::vector<const material*> materials;
+		std::unordered_map<const material*, uint32_t> material_index;
+
+		shared_ptr<hittable> root;
+
+		void make_blocks(std::vector<size_t>& order, size_t start, size_t end, hittable_list& blocks) const;
+};
+
+bool sphere_block::hit(const ray& r, real t_min, real t_max, hit_result& result) const {
+	const real ox = r.orig.x(), oy = r.orig.y(), oz = r.orig.z();
+	const real dx = r.dir.x(), dy = r.dir.y(), dz = r.dir.z();
+	const real a = dx * dx + dy * dy + dz * dz;
+	const real inv_a = 1 / a;
+
+	alignas(32) real roots[block_size];
+	for (int i = 0; i < block_size; i++) {
+		const real ocx = ox - center_x[i];
+		const real ocy = oy - center_y[i];
+		const real ocz = oz - center_z[i];
+		const real half_b = ocx * dx + ocy * dy + ocz * dz;
+		const real c = ocx * ocx + ocy * ocy + ocz * ocz - radius[i] * radius[i];
+
+		const real discriminant = half_b * half_b - a * c;
+		const real sqrtd = sqrt(discriminant > 0 ? discriminant : real(0));
+		const real near_root = (-half_b - sqrtd) * inv_a;
+		const real far_root = (-half_b + sqrtd) * inv_a;
+		const real root = near_root >= t_min ? near_root : far_root;
+
+		const bool valid = i < count && discriminant >= 0 && root >= t_min && root <= t_max;
+		roots[i] = valid ? root : infinity;
+	}
+
+	// Misses hold infinity, so a strict compare never selects one
+	int closest = -1;
+	real closest_t = infinity;
+	for (int i = 0; i < block_size; i++) {
+		if (roots[i] < closest_t) {
+			closest_t = roots[i];
+			closest = i;
+		}
+	}
+
+	if (closest < 0)
+		return false;
+
+	const point3 center(center_x[closest], center_y[closest], center_z[closest]);
+	result.t = closest_t;
+	result.p = r.at(closest_t);
+	vec3 outward_normal = (result.p - center) / radius[closest];
+	result.set_face_normal(r, outward_normal);
+	result.mat_ptr = materials[closest];
+
+	return true;
+}
+
+bool sphere_block::bounding_box(aabb& output_box) const {
+	output_box = box;
+	return true;
+}
+
+void sphere_set::add(point3 center, real radius, shared_ptr<material> m) {
+	auto found = material_index.find(m.get());
+	uint32_t id;
+	if (found == material_index.end()) {
+		id = static_cast<uint32_t>(materials.size());
+		material_index[m.get()] = id;
+		owned_materials.push_back(m);
+		materials.push_back(m.get());
+	} else {
+		id = found->second;
+	}
+
+	centers.push_back(center);
+	radii.push_back(radius);
+	material_ids.push_back(id);
+}
+
+void sphere_set::build() {
+	if (centers.empty())
+		return;
+
+	std::vector<size_t> order(centers.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	hittable_list blocks;
+	make_blocks(order, 0, order.size(), blocks);
+	root = make_shared<bvh_node>(blocks);
+}
+
+void sphere_set::make_blocks(std::vector<size_t>& order, size_t start, size_t end, hittable_list& blocks) const {
+	// Median splits along the longest axis keep each block spatially tight, so its box culls well
+	if (end - start > sphere_block::block_size) {
+		aabb centroid_bounds;
+		for (size_t i = start; i < end; i++)
+			centroid_bounds.expand(centers[order[i]]);
+		const int axis = centroid_bounds.longest_axis();
+
+		const size_t mid = start + (end - start) / 2;
+		std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](size_t a, size_t b) {
+			return centers[a][axis] < centers[b][axis];
+		});
+		make_blocks(order, start, mid, blocks);
+		make_blocks(order, mid, end, blocks);
+		return;
+	}
+
+	auto block = make_shared<sphere_block>();
+	for (size_t j = start; j < end; j++) {
+		const size_t i = order[j];
+		const int slot = block->count++;
+		const vec3 r(radii[i], radii[i], radii[i]);
+		block->center_x[slot] = centers[i].x();
+		block->center_y[slot] = centers[i].y();
+		block->center_z[slot] = centers[i].z();
+		block->radius[slot] = radii[i];
+		block->materials[slot] = materials[material_ids[i]];
+		block->box.expand(aabb(centers[i] - r, centers[i] + r));
+	}
+	blocks.add(block);
+}
+
+bool sphere_set::hit(const ray& r, real t_min, real t_max, hit_result& result) const {
+	return root && root->hit(r, t_min, t_max, result);
+}
+
+bool sphere_set::bounding_box(aabb& output_box) const {
+	return root && root->bounding_box(output_box);
+}
+
+void sphere_set::hit_packet(const ray_packet& packet, real t_min, packet_hit& hits) const {
+	if (root)
+		root->hit_packet(packet, t_min, hits);
+}
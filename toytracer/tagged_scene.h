@@ -0,0 +1,93 @@
+#pragma once
+
+#include "toytracer.h"
+
+#include "hittable.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <vector>
+
+// Closed-world scene representation. Primitives and materials are plain tagged structs kept in flat
+// arrays and dispatched with a switch, so hit and scatter calls can be inlined instead of going
+// through a vtable. The hittable and material class hierarchies remain the extensible path.
+
+struct tagged_material {
+	material_kind kind;
+	color albedo;
+	real roughness;
+
+	static tagged_material make_lambertian(const color& albedo) {
+		return { material_kind::lambertian, albedo, 0 };
+	}
+
+	static tagged_material make_metal(const color& albedo, real roughness) {
+		return { material_kind::metal, albedo, roughness < 1 ? roughness : 1 };
+	}
+
+	bool scatter(const ray& r_in, const hit_result& result, sampler& s, color& attenuation, ray& scattered) const {
+		switch (kind) {
+			case material_kind::lambertian:
+				return lambertian_scatter(albedo, result, s, attenuation, scattered);
+			case material_kind::metal:
+				return metal_scatter(albedo, roughness, r_in, result, s, attenuation, scattered);
+			case material_kind::other:
+				break; // Tagged materials are always one of the built-in types
+		}
+		return false;
+	}
+};
+
+enum class primitive_kind : uint8_t { sphere };
+
+struct tagged_primitive {
+	primitive_kind kind;
+	uint32_t material_id;
+	point3 center;
+	real radius;
+
+	static tagged_primitive make_sphere(const point3& center, real radius, uint32_t material_id) {
+		return { primitive_kind::sphere, material_id, center, radius };
+	}
+
+	bool hit(const ray& r, real t_min, real t_max, hit_result& result) const {
+		switch (kind) {
+			case primitive_kind::sphere:
+				return hit_sphere(center, radius, r, t_min, t_max, result);
+		}
+		return false;
+	}
+};
+
+class tagged_scene {
+	public:
+		uint32_t add_material(const tagged_material& m) {
+			materials.push_back(m);
+			return static_cast<uint32_t>(materials.size() - 1);
+		}
+
+		void add(const tagged_primitive& p) { primitives.push_back(p); }
+
+		// Finds the closest hit. result.mat_ptr is left null; material_id receives the hit material.
+		bool hit(const ray& r, real t_min, real t_max, hit_result& result, uint32_t& material_id) const;
+
+	public:
+		std::vector<tagged_primitive> primitives;
+		std::vector<tagged_material> materials;
+};
+
+bool tagged_scene::hit(const ray& r, real t_min, real t_max, hit_result& result, uint32_t& material_id) const {
+	bool hit_anything = false;
+	auto closest_so_far = t_max;
+
+	for (const auto& primitive : primitives) {
+		if (primitive.hit(r, t_min, closest_so_far, result)) {
+			hit_anything = true;
+			closest_so_far = result.t;
+			material_id = primitive.material_id;
+		}
+	}
+
+	result.mat_ptr = nullptr;
+	return hit_anything;
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool with one worker per hardware thread. Each worker owns a deque; it pops its own
+// jobs from the back and, when that runs dry, steals from the front of the other workers' deques.
+// Urgent jobs go to a shared queue that every worker takes from before its own deque, so they run
+// as soon as a worker finishes its current job however many jobs are queued.
+class thread_pool {
+	public:
+		using job = std::function<void()>;
+
+		struct stats {
+			size_t queued;       // Jobs waiting in worker deques or the urgent queue
+			size_t active;       // Jobs currently executing
+			uint64_t completed;  // Jobs finished since the pool was created
+			uint64_t steals;     // Jobs taken from another worker's deque
+			double busy_seconds; // Time workers have spent running jobs, summed over workers
+		};
+
+		thread_pool(unsigned int thread_count = std::thread::hardware_concurrency());
+		~thread_pool();
+
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		void submit(job j);
+		// Queues j ahead of every submitted job. Urgent jobs are neither dropped by cancel_pending nor
+		// counted by pending and wait_idle, so whoever submits one tracks its completion.
+		void submit_urgent(job j);
+		size_t cancel_pending();
+		void wait_idle();
+		// Waits at most timeout seconds; returns whether the pool went idle
+		bool wait_idle_for(double timeout);
+
+		// Runs body(i) for every i in [0, count) and returns once all have run. The calling thread works
+		// through the indices itself, and urgent helper jobs let workers join in as they finish their
+		// current jobs, so this never waits behind queued jobs.
+		template <typename F>
+		void parallel_for(size_t count, const F& body);
+
+		unsigned int size() const { return static_cast<unsigned int>(queues.size()); }
+		size_t pending() const { return outstanding_jobs.load(); }
+		size_t queue_depth(unsigned int worker) const;
+		stats get_stats() const;
+
+	private:
+		struct worker_queue {
+			mutable std::mutex mutex;
+			std::deque<job> jobs;
+		};
+
+		std::vector<std::thread> workers;
+		std::vector<std::unique_ptr<worker_queue>> queues;
+		worker_queue urgent_queue;
+		std::atomic<unsigned int> next_queue{ 0 };
+
+		std::atomic<size_t> queued_jobs{ 0 };
+		std::atomic<size_t> outstanding_jobs{ 0 };
+		std::atomic<uint64_t> completed_jobs{ 0 };
+		std::atomic<uint64_t> stolen_jobs{ 0 };
+		std::atomic<uint64_t> busy_nanoseconds{ 0 };
+
+		std::mutex sleep_mutex;
+		std::condition_variable sleep_cv;
+		std::mutex idle_mutex;
+		std::condition_variable idle_cv;
+		bool stopping = false;
+
+		void worker_loop(unsigned int index);
+		bool pop_urgent(job& j);
+		bool pop_local(unsigned int index, job& j);
+		bool steal(unsigned int index, job& j);
+};
+
+thread_pool::thread_pool(unsigned int thread_count) {
+	if (thread_count == 0)
+		thread_count = 1;
+
+	for (unsigned int i = 0; i < thread_count; i++)
+		queues.push_back(std::make_unique<worker_queue>());
+	for (unsigned int i = 0; i < thread_count; i++)
+		workers.emplace_back(&thread_pool::worker_loop, this, i);
+}
+
+thread_pool::~thread_pool() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	sleep_cv.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void thread_pool::submit(job j) {
+	auto index = next_queue.fetch_add(1, std::memory_order_relaxed) % size();
+	outstanding_jobs++;
+	{
+		// Counted before the push so a worker can never pop a job that isn't counted yet, and
+		// under the sleep mutex so a worker about to sleep can't miss the wakeup
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		queued_jobs++;
+	}
+	{
+		std::lock_guard<std::mutex> lock(queues[index]->mutex);
+		queues[index]->jobs.push_back(std::move(j));
+	}
+	sleep_cv.notify_one();
+}
+
+void thread_pool::submit_urgent(job j) {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		queued_jobs++;
+	}
+	{
+		std::lock_guard<std::mutex> lock(urgent_queue.mutex);
+		urgent_queue.jobs.push_back(std::move(j));
+	}
+	sleep_cv.notify_one();
+}
+
+size_t thread_pool::cancel_pending() {
+	// Drops jobs that haven't started yet; jobs already running are left to finish or bail out
+	size_t cancelled = 0;
+	for (auto& queue : queues) {
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		cancelled += queue->jobs.size();
+		queued_jobs -= queue->jobs.size();
+		queue->jobs.clear();
+	}
+
+	if (cancelled > 0 && (outstanding_jobs -= cancelled) == 0) {
+		std::lock_guard<std::mutex> lock(idle_mutex);
+		idle_cv.notify_all();
+	}
+	return cancelled;
+}
+
+void thread_pool::wait_idle() {
+	std::unique_lock<std::mutex> lock(idle_mutex);
+	idle_cv.wait(lock, [this] { return outstanding_jobs.load() == 0; });
+}
+
+bool thread_pool::wait_idle_for(double timeout) {
+	std::unique_lock<std::mutex> lock(idle_mutex);
+	return idle_cv.wait_for(lock, std::chrono::duration<double>(timeout), [this] { return outstanding_jobs.load() == 0; });
+}
+
+template <typename F>
+void thread_pool::parallel_for(size_t count, const F& body) {
+	struct progress {
+		std::atomic<size_t> next{ 0 };
+		std::atomic<size_t> done{ 0 };
+	};
+
+	// Helpers can start after every index is claimed, even after this returns; they then touch neither
+	// body nor anything else on this stack, only the shared progress
+	auto state = std::make_shared<progress>();
+	const F* body_ptr = &body;
+	auto work = [state, count, body_ptr] {
+		for (size_t i = state->next++; i < count; i = state->next++) {
+			(*body_ptr)(i);
+			state->done.fetch_add(1, std::memory_order_release);
+		}
+	};
+
+	for (size_t i = 1; i < size() && i < count; i++)
+		submit_urgent(work);
+	work();
+	while (state->done.load(std::memory_order_acquire) < count)
+		std::this_thread::yield();
+}
+
+size_t thread_pool::queue_depth(unsigned int worker) const {
+	std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+	return queues[worker]->jobs.size();
+}
+
+thread_pool::stats thread_pool::get_stats() const {
+	stats s;
+	s.queued = queued_jobs.load();
+	auto outstanding = outstanding_jobs.load();
+	s.active = outstanding > s.queued ? outstanding - s.queued : 0;
+	s.completed = completed_jobs.load();
+	s.steals = stolen_jobs.load();
+	s.busy_seconds = busy_nanoseconds.load() * 1e-9;
+	return s;
+}
+
+void thread_pool::worker_loop(unsigned int index) {
+	while (true) {
+		job j;
+		const bool urgent = pop_urgent(j);
+		if (urgent || pop_local(index, j) || steal(index, j)) {
+			queued_jobs--;
+			auto start = std::chrono::steady_clock::now();
+			j();
+			auto end = std::chrono::steady_clock::now();
+			busy_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+			completed_jobs++;
+
+			if (!urgent && --outstanding_jobs == 0) {
+				std::lock_guard<std::mutex> lock(idle_mutex);
+				idle_cv.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleep_cv.wait(lock, [this] { return stopping || queued_jobs.load() > 0; });
+		if (stopping && queued_jobs.load() == 0)
+			return;
+	}
+}
+
+bool thread_pool::pop_urgent(job& j) {
+	std::lock_guard<std::mutex> lock(urgent_queue.mutex);
+	if (urgent_queue.jobs.empty())
+		return false;
+
+	j = std::move(urgent_queue.jobs.front());
+	urgent_queue.jobs.pop_front();
+	return true;
+}
+
+bool thread_pool::pop_local(unsigned int index, job& j) {
+	auto& queue = *queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.jobs.empty())
+		return false;
+
+	j = std::move(queue.jobs.back());
+	queue.jobs.pop_back();
+	return true;
+}
+
+bool thread_pool::steal(unsigned int index, job& j) {
+	for (unsigned int offset = 1; offset < size(); offset++) {
+		auto& victim = *queues[(index + offset) % size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (victim.jobs.empty())
+			continue;
+
+		j = std::move(victim.jobs.front());
+		victim.jobs.pop_front();
+		stolen_jobs++;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// Splits the frame into square screen-space tiles visited in Morton (Z-curve) order, so
+// consecutive tiles are spatially close and trace coherent rays. A tile is claimed by one job at a
+// time, which gives that job exclusive ownership of the tile's pixels for the pass.
+class tile_scheduler {
+	public:
+		struct tile {
+			int x0, y0;  // Inclusive top-left corner
+			int x1, y1;  // Exclusive bottom-right corner
+
+			int width() const { return x1 - x0; }
+			int height() const { return y1 - y0; }
+			int pixel_count() const { return width() * height(); }
+		};
+
+		struct tile_cost {
+			double last_pass_seconds = 0.0;  // Time the most recent completed pass took
+			double total_seconds = 0.0;      // Time spent on the tile across all passes
+			uint64_t passes = 0;
+		};
+
+		tile_scheduler() {}
+		tile_scheduler(int width, int height, int tile_size = 32) { reset(width, height, tile_size); }
+
+		void reset(int width, int height, int tile_size = 32);
+
+		size_t tile_count() const { return tiles.size(); }
+		const tile& get_tile(size_t index) const { return tiles[index]; }
+
+		// Claims a tile for a pass; fails if another job already owns it
+		bool try_acquire(size_t index);
+		// Hands the tile back, recording the pass time if the pass ran to completion
+		void release(size_t index, double seconds, bool completed);
+		// Forgets every claim; only safe once no jobs are in flight
+		void release_all();
+
+		// Cost statistics and splitting read and rewrite all tiles, so call them only while no jobs are in flight
+		const tile_cost& cost(size_t index) const { return costs[index]; }
+		size_t split_expensive_tiles(double cost_factor, int min_tile_size = 8);
+		void report(std::ostream& out, size_t count = 5) const;
+
+	private:
+		std::vector<tile> tiles;
+		std::vector<tile_cost> costs;
+		std::unique_ptr<std::atomic<bool>[]> busy;
+
+		void reset_claims();
+};
+
+inline uint32_t morton_part1by1(uint32_t v) {
+	// Spreads the low 16 bits of v so a zero bit sits between each of them
+	v &= 0x0000ffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+inline uint32_t morton_encode(uint32_t x, uint32_t y) {
+	return morton_part1by1(x) | (morton_part1by1(y) << 1);
+}
+
+void tile_scheduler::reset(int width, int height, int tile_size) {
+	struct keyed_tile {
+		uint32_t key;
+		tile t;
+	};
+
+	std::vector<keyed_tile> keyed;
+	for (int ty = 0; ty * tile_size < height; ty++) {
+		for (int tx = 0; tx * tile_size < width; tx++) {
+			tile t;
+			t.x0 = tx * tile_size;
+			t.y0 = ty * tile_size;
+			t.x1 = std::min(t.x0 + tile_size, width);
+			t.y1 = std::min(t.y0 + tile_size, height);
+			keyed.push_back({ morton_encode(tx, ty), t });
+		}
+	}
+
+	std::sort(keyed.begin(), keyed.end(), [](const keyed_tile& a, const keyed_tile& b) { return a.key < b.key; });
+
+	tiles.clear();
+	for (const auto& k : keyed)
+		tiles.push_back(k.t);
+	costs.assign(tiles.size(), tile_cost());
+	reset_claims();
+}
+
+bool tile_scheduler::try_acquire(size_t index) {
+	bool expected = false;
+	return busy[index].compare_exchange_strong(expected, true, std::memory_order_acquire);
+}
+
+void tile_scheduler::release(size_t index, double seconds, bool completed) {
+	if (completed) {
+		costs[index].last_pass_seconds = seconds;
+		costs[index].total_seconds += seconds;
+		costs[index].passes++;
+	}
+	busy[index].store(false, std::memory_order_release);
+}
+
+void tile_scheduler::release_all() {
+	for (size_t i = 0; i < tiles.size(); i++)
+		busy[i].store(false, std::memory_order_relaxed);
+}
+
+size_t tile_scheduler::split_expensive_tiles(double cost_factor, int min_tile_size) {
+	double mean = 0.0;
+	size_t measured = 0;
+	for (const auto& c : costs) {
+		if (c.passes > 0) {
+			mean += c.last_pass_seconds;
+			measured++;
+		}
+	}
+	if (measured == 0)
+		return 0;
+	mean /= measured;
+
+	// Split tiles that cost far more than the average into quadrants, in place so the curve order holds
+	std::vector<tile> new_tiles;
+	std::vector<tile_cost> new_costs;
+	size_t split_count = 0;
+	for (size_t i = 0; i < tiles.size(); i++) {
+		const auto& t = tiles[i];
+		const bool splittable = t.width() >= 2 * min_tile_size && t.height() >= 2 * min_tile_size;
+		if (!splittable || costs[i].passes == 0 || costs[i].last_pass_seconds <= cost_factor * mean) {
+			new_tiles.push_back(t);
+			new_costs.push_back(costs[i]);
+			continue;
+		}
+
+		const int mx = t.x0 + t.width() / 2;
+		const int my = t.y0 + t.height() / 2;
+		const tile quadrants[4] = {
+			{ t.x0, t.y0, mx, my }, { mx, t.y0, t.x1, my },
+			{ t.x0, my, mx, t.y1 }, { mx, my, t.x1, t.y1 },
+		};
+		for (const auto& q : quadrants) {
+			tile_cost c = costs[i];
+			c.last_pass_seconds *= double(q.pixel_count()) / t.pixel_count();
+			c.total_seconds *= double(q.pixel_count()) / t.pixel_count();
+			new_tiles.push_back(q);
+			new_costs.push_back(c);
+		}
+		split_count++;
+	}
+
+	tiles.swap(new_tiles);
+	costs.swap(new_costs);
+	reset_claims();
+	return split_count;
+}
+
+void tile_scheduler::report(std::ostream& out, size_t count) const {
+	std::vector<size_t> order(tiles.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return costs[a].total_seconds > costs[b].total_seconds; });
+
+	out << "Most expensive of " << tiles.size() << " tiles:" << std::endl;
+	for (size_t n = 0; n < std::min(count, order.size()); n++) {
+		const auto& t = tiles[order[n]];
+		const auto& c = costs[order[n]];
+		out << "  (" << t.x0 << ", " << t.y0 << ") " << t.width() << "x" << t.height() << ": "
+		    << c.total_seconds * 1000.0 << " ms over " << c.passes << " passes" << std::endl;
+	}
+}
+
+void tile_scheduler::reset_claims() {
+	busy.reset(new std::atomic<bool>[tiles.size()]);
+	release_all();
+}
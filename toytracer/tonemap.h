@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Display transform from linear HDR values to 8-bit: exposure, a tonemap operator, then gamma 2.0.
+// The AVX2 kernel handles 32 channel values per iteration. The project builds with /arch:AVX2; builds
+// without it use the scalar version, which is about 20 times slower.
+
+enum class tonemap_operator { clamp, reinhard, aces };
+
+struct tonemap_settings {
+	float exposure = 0.0f; // In stops; values are scaled by 2^exposure before the operator
+	tonemap_operator op = tonemap_operator::clamp;
+
+	float exposure_scale() const { return std::exp2(exposure); }
+};
+
+inline const char* tonemap_name(tonemap_operator op) {
+	switch (op) {
+		case tonemap_operator::reinhard: return "reinhard";
+		case tonemap_operator::aces: return "aces";
+		default: return "clamp";
+	}
+}
+
+inline bool parse_tonemap(const std::string& name, tonemap_operator& op) {
+	for (auto candidate : { tonemap_operator::clamp, tonemap_operator::reinhard, tonemap_operator::aces }) {
+		if (name == tonemap_name(candidate)) {
+			op = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Maps an exposed linear value into [0, 1]
+inline float apply_tonemap(tonemap_operator op, float x) {
+	if (!(x > 0.0f)) // Also maps NaN to black, as the AVX2 kernel does
+		return 0.0f;
+
+	switch (op) {
+		case tonemap_operator::reinhard:
+			x = x / (1.0f + x);
+			break;
+		case tonemap_operator::aces:
+			// Narkowicz's curve fit of the ACES filmic tonemapper
+			x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+			break;
+		default:
+			break;
+	}
+	return x < 1.0f ? x : 1.0f;
+}
+
+inline uint8_t tonemap_byte(tonemap_operator op, float exposed) {
+	return static_cast<uint8_t>(255.999f * std::sqrt(apply_tonemap(op, exposed)));
+}
+
+#if defined(__AVX2__)
+// Tonemaps 8 values already multiplied by scale and exposure, returning bytes in the low bits of
+// each 32-bit lane. Negative and NaN values come out as 0.
+template <tonemap_operator Op>
+inline __m256i tonemap_lanes(__m256 x) {
+	const __m256 one = _mm256_set1_ps(1.0f);
+	if (Op == tonemap_operator::reinhard) {
+		x = _mm256_max_ps(x, _mm256_setzero_ps());
+		x = _mm256_mul_ps(x, _mm256_rcp_ps(_mm256_add_ps(one, x)));
+	} else if (Op == tonemap_operator::aces) {
+		x = _mm256_max_ps(x, _mm256_setzero_ps());
+		const __m256 num = _mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.51f), x), _mm256_set1_ps(0.03f)));
+		const __m256 den = _mm256_add_ps(_mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.43f), x), _mm256_set1_ps(0.59f))), _mm256_set1_ps(0.14f));
+		x = _mm256_mul_ps(num, _mm256_rcp_ps(den));
+	}
+
+	// min with 1 first keeps NaN (minps returns its second operand on NaN). sqrt is x * rsqrt(x); like
+	// rcp above, the approximation's 12 bits are plenty for an 8-bit result. For x <= 0 or NaN the
+	// product is NaN, which converts to INT_MIN and saturates to 0 in the packs.
+	x = _mm256_min_ps(one, x);
+	x = _mm256_mul_ps(_mm256_mul_ps(x, _mm256_rsqrt_ps(x)), _mm256_set1_ps(255.999f));
+	return _mm256_cvttps_epi32(x);
+}
+
+template <tonemap_operator Op>
+size_t tonemap_channels_avx2(float scale, const float* in, uint8_t* out, size_t count) {
+	const __m256 vscale = _mm256_set1_ps(scale);
+	const __m256i byte_order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		const __m256i v0 = tonemap_lanes<Op>(_mm256_mul_ps(_mm256_loadu_ps(in + i), vscale));
+		const __m256i v1 = tonemap_lanes<Op>(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), vscale));
+		const __m256i v2 = tonemap_lanes<Op>(_mm256_mul_ps(_mm256_loadu_ps(in + i + 16), vscale));
+		const __m256i v3 = tonemap_lanes<Op>(_mm256_mul_ps(_mm256_loadu_ps(in + i + 24), vscale));
+
+		// The packs work within 128-bit halves, so the 4-byte groups come out interleaved
+		const __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(v0, v1), _mm256_packus_epi32(v2, v3));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permutevar8x32_epi32(bytes, byte_order));
+	}
+	return i;
+}
+#endif
+
+// Converts count channel values to display bytes. Values are multiplied by scale (e.g. one over the
+// sample count) and the exposure before the operator.
+void tonemap_channels(const tonemap_settings& settings, float scale, const float* in, uint8_t* out, size_t count) {
+	scale *= settings.exposure_scale();
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	switch (settings.op) {
+		case tonemap_operator::reinhard:
+			i = tonemap_channels_avx2<tonemap_operator::reinhard>(scale, in, out, count);
+			break;
+		case tonemap_operator::aces:
+			i = tonemap_channels_avx2<tonemap_operator::aces>(scale, in, out, count);
+			break;
+		default:
+			i = tonemap_channels_avx2<tonemap_operator::clamp>(scale, in, out, count);
+			break;
+	}
+#endif
+
+	for (; i < count; i++)
+		out[i] = tonemap_byte(settings.op, in[i] * scale);
+}
+
+#if defined(__AVX2__)
+template <tonemap_operator Op>
+size_t tonemap_rgba_avx2(float scale, const float* rgb, uint8_t* rgba, size_t pixel_count) {
+	const __m256 vscale = _mm256_set1_ps(scale);
+	// Gathers the 24 packed bytes so each 128-bit half holds four pixels, then spreads them to RGBA
+	const __m256i pixel_order = _mm256_setr_epi32(0, 4, 1, 3, 5, 2, 6, 3);
+	const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+	                                        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m256i alpha = _mm256_set1_epi32(int(0xff000000));
+
+	size_t i = 0;
+	for (; i + 8 <= pixel_count; i += 8) {
+		const float* p = rgb + i * 3;
+		const __m256i v0 = tonemap_lanes<Op>(_mm256_mul_ps(_mm256_loadu_ps(p), vscale));
+		const __m256i v1 = tonemap_lanes<Op>(_mm256_mul_ps(_mm256_loadu_ps(p + 8), vscale));
+		const __m256i v2 = tonemap_lanes<Op>(_mm256_mul_ps(_mm256_loadu_ps(p + 16), vscale));
+
+		const __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(v0, v1), _mm256_packus_epi32(v2, _mm256_setzero_si256()));
+		const __m256i pixels = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(bytes, pixel_order), spread);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + i * 4), _mm256_or_si256(pixels, alpha));
+	}
+	return i;
+}
+#endif
+
+// Converts packed linear RGB floats straight to the ABGR8888 texture layout (bytes r, g, b, 255),
+// with the same transform as tonemap_channels
+void tonemap_rgba(const tonemap_settings& settings, float scale, const float* rgb, uint8_t* rgba, size_t pixel_count) {
+	scale *= settings.exposure_scale();
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	switch (settings.op) {
+		case tonemap_operator::reinhard:
+			i = tonemap_rgba_avx2<tonemap_operator::reinhard>(scale, rgb, rgba, pixel_count);
+			break;
+		case tonemap_operator::aces:
+			i = tonemap_rgba_avx2<tonemap_operator::aces>(scale, rgb, rgba, pixel_count);
+			break;
+		default:
+			i = tonemap_rgba_avx2<tonemap_operator::clamp>(scale, rgb, rgba, pixel_count);
+			break;
+	}
+#endif
+
+	for (; i < pixel_count; i++) {
+		rgba[i * 4 + 0] = tonemap_byte(settings.op, rgb[i * 3 + 0] * scale);
+		rgba[i * 4 + 1] = tonemap_byte(settings.op, rgb[i * 3 + 1] * scale);
+		rgba[i * 4 + 2] = tonemap_byte(settings.op, rgb[i * 3 + 2] * scale);
+		rgba[i * 4 + 3] = 255;
+	}
+}
@@ -5,22 +5,23 @@
 #include <memory>
 #include <random>
 
+#include "real.h"
+#include "rng.h"
+
 using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = real(3.1415926535897932385);
 
-inline double degrees_to_radians(double degrees) {
-	return degrees * pi / 180.0;
+inline real degrees_to_radians(real degrees) {
+	return degrees * pi / 180;
 }
 
 inline double random_double() {
 	// Returns a random real in [0,1)
-	uint32_t a;
-	_rdrand32_step(&a);
-	return a / double(_UI32_MAX);
+	return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
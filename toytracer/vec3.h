@@ -1,129 +1,191 @@
 #pragma once
 
+#include "real.h"
+
 #include <cmath>
 #include <iostream>
 
 using std::sqrt;
 
-class vec3
+template <typename T>
+class scalar_vec3
 {
 	public:
-		vec3() : e{ 0,0,0 } {}
-		vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+		scalar_vec3() : e{ 0,0,0 } {}
+		scalar_vec3(T e0, T e1, T e2) : e{ e0, e1, e2 } {}
 
-		double x() const { return e[0]; }
-		double y() const { return e[1]; }
-		double z() const { return e[2]; }
+		T x() const { return e[0]; }
+		T y() const { return e[1]; }
+		T z() const { return e[2]; }
 
-		vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-		double operator[](int i) const { return e[i]; }
-		double& operator[](int i) { return e[i]; }
+		scalar_vec3 operator-() const { return scalar_vec3(-e[0], -e[1], -e[2]); }
+		T operator[](int i) const { return e[i]; }
+		T& operator[](int i) { return e[i]; }
 
-		vec3& operator+=(const vec3& v) {
+		scalar_vec3& operator+=(const scalar_vec3& v) {
 			e[0] += v.e[0];
 			e[1] += v.e[1];
 			e[2] += v.e[2];
 			return *this;
 		}
 
-		vec3& operator*=(const double t) {
+		scalar_vec3& operator*=(const T t) {
 			e[0] *= t;
 			e[1] *= t;
 			e[2] *= t;
 			return *this;
 		}
 
-		vec3& operator/=(const double t) {
+		scalar_vec3& operator/=(const T t) {
 			return *this *= 1 / t;
 		}
 
-		double length() const {
+		T length() const {
 			return sqrt(length_squared());
 		}
 
-		double length_squared() const {
+		T length_squared() const {
 			return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
 		}
 
-		inline static vec3 random() {
-			return vec3(random_double(), random_double(), random_double());
+		inline static scalar_vec3 random() {
+			return scalar_vec3(T(random_double()), T(random_double()), T(random_double()));
 		}
 
-		inline static vec3 random(double min, double max) {
-			return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+		inline static scalar_vec3 random(T min, T max) {
+			return scalar_vec3(T(random_double(min, max)), T(random_double(min, max)), T(random_double(min, max)));
 		}
 
 		bool near_zero() const {
 			// Return true if the vector is close to zero in all dimensions
-			const auto s = 1e-8;
+			const auto s = precision_traits<T>::near_zero_threshold;
 			return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
 		}
 
+		// Utility functions, as hidden friends so scalars of another precision still convert
+
+		friend inline std::ostream& operator<<(std::ostream& out, const scalar_vec3& v) {
+			return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+		}
+
+		friend inline scalar_vec3 operator+(const scalar_vec3& u, const scalar_vec3& v) {
+			return scalar_vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+		}
+
+		friend inline scalar_vec3 operator-(const scalar_vec3& u, const scalar_vec3& v) {
+			return scalar_vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+		}
+
+		friend inline scalar_vec3 operator*(const scalar_vec3& u, const scalar_vec3& v) {
+			return scalar_vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+		}
+
+		friend inline scalar_vec3 operator*(const T u, const scalar_vec3& v) {
+			return scalar_vec3(u * v.e[0], u * v.e[1], u * v.e[2]);
+		}
+
+		friend inline scalar_vec3 operator*(const scalar_vec3& v, const T t) {
+			return t * v;
+		}
+
+		friend inline scalar_vec3 operator/(scalar_vec3 v, T t) {
+			return (1 / t) * v;
+		}
+
+		friend inline T dot(const scalar_vec3& u, const scalar_vec3& v) {
+			return u.e[0] * v.e[0] +
+			       u.e[1] * v.e[1] +
+			       u.e[2] * v.e[2];
+		}
+
+		friend inline scalar_vec3 cross(const scalar_vec3& u, const scalar_vec3& v) {
+			return scalar_vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+			                   u.e[2] * v.e[0] - u.e[0] * v.e[2],
+			                   u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+		}
+
+		friend inline scalar_vec3 unit_vector(scalar_vec3 v) {
+			return v / v.length();
+		}
+
 	public:
-		double e[3];
+		T e[3];
 };
 
-// Type aliases
+// Defining TOYTRACER_SIMD_VEC3 swaps scalar_vec3 for the SIMD-backed simd_vec3: AVX2 lanes for a
+// double build, SSE2 lanes for a float build (TOYTRACER_FLOAT). It runs sphere::hit slower than the
+// scalar backend (--bench sphere), so it stays off by default.
+#if defined(TOYTRACER_SIMD_VEC3)
 
-using point3 = vec3;
-using color = vec3;
+#include "vec3_simd.h"
 
-// Utility functions
+#if !defined(TOYTRACER_FLOAT) && !defined(__AVX2__)
+#error "The double precision SIMD vec3 needs AVX2; enable /arch:AVX2 or define TOYTRACER_FLOAT"
+#endif
 
-inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
-	return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
-}
+template <typename T> using vec3_t = simd_vec3<T>;
+#define TOYTRACER_VEC3_BACKEND_KIND "SIMD"
 
-inline vec3 operator+(const vec3& u, const vec3& v) {
-	return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
-}
+#else
 
-inline vec3 operator-(const vec3& u, const vec3& v) {
-	return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
-}
+template <typename T> using vec3_t = scalar_vec3<T>;
+#define TOYTRACER_VEC3_BACKEND_KIND "scalar"
 
-inline vec3 operator*(const vec3& u, const vec3& v) {
-	return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
-}
+#endif
 
-inline vec3 operator*(const double u, const vec3& v) {
-	return vec3(u * v.e[0], u * v.e[1], u * v.e[2]);
-}
+#if defined(TOYTRACER_FLOAT)
+#define TOYTRACER_VEC3_BACKEND TOYTRACER_VEC3_BACKEND_KIND " float"
+#else
+#define TOYTRACER_VEC3_BACKEND TOYTRACER_VEC3_BACKEND_KIND " double"
+#endif
 
-inline vec3 operator*(const vec3& v, const double t) {
-	return t * v;
-}
+// Type aliases
+
+using vec3 = vec3_t<real>;
+using point3 = vec3;
+using color = vec3;
+
+// Sampling helpers shared by every vec3 backend
+
+// The sample_ functions map uniform numbers in [0, 1) to a distribution in closed form. Unlike
+// rejection sampling they take a fixed number of inputs and never branch, so they can be fed
+// low-discrepancy samples.
 
-inline vec3 operator/(vec3 v, double t) {
-	return (1 / t) * v;
+// Uniformly distributed direction, from two numbers
+inline vec3 sample_unit_vector(double u, double v) {
+	const double z = 1 - 2 * u;
+	const double r = std::sqrt(fmax(0.0, 1 - z * z));
+	const double phi = 2 * pi * v;
+	return vec3(real(r * std::cos(phi)), real(r * std::sin(phi)), real(z));
 }
 
-inline double dot(const vec3& u, const vec3& v) {
-	return u.e[0] * v.e[0] +
-	       u.e[1] * v.e[1] +
-	       u.e[2] * v.e[2];
+// Uniformly distributed point in the unit ball, mapped from three uniform numbers in [0, 1)
+inline vec3 sample_in_unit_sphere(double u, double v, double w) {
+	return real(std::cbrt(w)) * sample_unit_vector(u, v);
 }
 
-inline vec3 cross(const vec3& u, const vec3& v) {
-	return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-	            u.e[2] * v.e[0] - u.e[0] * v.e[2],
-	            u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+// Uniformly distributed point in the unit disk in the xy plane, from two numbers
+inline vec3 sample_in_unit_disk(double u, double v) {
+	const double r = std::sqrt(u);
+	const double phi = 2 * pi * v;
+	return vec3(real(r * std::cos(phi)), real(r * std::sin(phi)), 0);
 }
 
-inline vec3 unit_vector(vec3 v) {
-	return v / v.length();
+// Direction in the +z hemisphere with density cos(theta) / pi, from two numbers: a uniform disk point
+// lifted onto the hemisphere (Malley's method)
+inline vec3 sample_cosine_hemisphere(double u, double v) {
+	const vec3 d = sample_in_unit_disk(u, v);
+	return vec3(d.x(), d.y(), real(std::sqrt(fmax(0.0, 1 - u))));
 }
 
 inline vec3 random_in_unit_sphere() {
-	while (true) {
-		auto p = vec3::random(-1, 1);
-		if (p.length_squared() >= 1) continue;
-		return p;
-	}
+	const double u = random_double(), v = random_double();
+	return sample_in_unit_sphere(u, v, random_double());
 }
 
 inline vec3 random_unit_vector() {
-	return unit_vector(random_in_unit_sphere());
+	const double u = random_double();
+	return sample_unit_vector(u, random_double());
 }
 
 vec3 reflect(const vec3& v, const vec3& n) {
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "real.h"
+
+#include <cmath>
+#include <immintrin.h>
+#include <iostream>
+
+// SIMD-backed drop-in for vec3. Components live in a 4-lane register with the fourth lane kept at
+// zero as padding. The double variant uses AVX2 (4 x double), the float variant SSE2 (4 x float).
+
+template <typename T> struct simd_traits;
+
+template <> struct simd_traits<float> {
+	using reg = __m128;
+
+	static reg zero() { return _mm_setzero_ps(); }
+	static reg set(float x, float y, float z) { return _mm_set_ps(0.0f, z, y, x); }
+	static reg splat(float s) { return _mm_set1_ps(s); }
+	static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+	static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+	static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+	static reg abs(reg a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	static int lt_mask(reg a, reg b) { return _mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+
+	// Rotates lanes to (y, z, x, w)
+	static reg yzx(reg a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+	static float dot3(reg a, reg b) {
+		reg m = _mm_mul_ps(a, b);
+		reg y = _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1));
+		reg z = _mm_movehl_ps(m, m);
+		return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(m, y), z));
+	}
+};
+
+#ifdef __AVX2__
+template <> struct simd_traits<double> {
+	using reg = __m256d;
+
+	static reg zero() { return _mm256_setzero_pd(); }
+	static reg set(double x, double y, double z) { return _mm256_set_pd(0.0, z, y, x); }
+	static reg splat(double s) { return _mm256_set1_pd(s); }
+	static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+	static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+	static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+	static reg abs(reg a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+	static int lt_mask(reg a, reg b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ)); }
+
+	// Rotates lanes to (y, z, x, w)
+	static reg yzx(reg a) { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+	static double dot3(reg a, reg b) {
+		reg m = _mm256_mul_pd(a, b);
+		__m128d xy = _mm256_castpd256_pd128(m);
+		__m128d zw = _mm256_extractf128_pd(m, 1);
+		__m128d sum = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));
+		return _mm_cvtsd_f64(_mm_add_sd(sum, zw));
+	}
+};
+#endif
+
+template <typename T>
+class simd_vec3
+{
+	public:
+		using ops = simd_traits<T>;
+		using reg = typename ops::reg;
+
+		simd_vec3() : v(ops::zero()) {}
+		simd_vec3(T e0, T e1, T e2) : v(ops::set(e0, e1, e2)) {}
+		explicit simd_vec3(reg r) : v(r) {}
+
+		T x() const { return e[0]; }
+		T y() const { return e[1]; }
+		T z() const { return e[2]; }
+
+		simd_vec3 operator-() const { return simd_vec3(ops::sub(ops::zero(), v)); }
+		T operator[](int i) const { return e[i]; }
+		T& operator[](int i) { return e[i]; }
+
+		simd_vec3& operator+=(const simd_vec3& u) {
+			v = ops::add(v, u.v);
+			return *this;
+		}
+
+		simd_vec3& operator*=(const T t) {
+			v = ops::mul(v, ops::splat(t));
+			return *this;
+		}
+
+		simd_vec3& operator/=(const T t) {
+			return *this *= 1 / t;
+		}
+
+		T length() const {
+			return std::sqrt(length_squared());
+		}
+
+		T length_squared() const {
+			return ops::dot3(v, v);
+		}
+
+		inline static simd_vec3 random() {
+			return simd_vec3(T(random_double()), T(random_double()), T(random_double()));
+		}
+
+		inline static simd_vec3 random(T min, T max) {
+			return simd_vec3(T(random_double(min, max)), T(random_double(min, max)), T(random_double(min, max)));
+		}
+
+		bool near_zero() const {
+			// Return true if the vector is close to zero in all dimensions
+			const T s = precision_traits<T>::near_zero_threshold;
+			return (ops::lt_mask(ops::abs(v), ops::splat(s)) & 0x7) == 0x7;
+		}
+
+		// Operators are hidden friends rather than templates so scalars of another type still convert
+
+		friend inline std::ostream& operator<<(std::ostream& out, const simd_vec3& v) {
+			return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+		}
+
+		friend inline simd_vec3 operator+(const simd_vec3& u, const simd_vec3& v) {
+			return simd_vec3(ops::add(u.v, v.v));
+		}
+
+		friend inline simd_vec3 operator-(const simd_vec3& u, const simd_vec3& v) {
+			return simd_vec3(ops::sub(u.v, v.v));
+		}
+
+		friend inline simd_vec3 operator*(const simd_vec3& u, const simd_vec3& v) {
+			return simd_vec3(ops::mul(u.v, v.v));
+		}
+
+		friend inline simd_vec3 operator*(const T u, const simd_vec3& v) {
+			return simd_vec3(ops::mul(ops::splat(u), v.v));
+		}
+
+		friend inline simd_vec3 operator*(const simd_vec3& v, const T t) {
+			return t * v;
+		}
+
+		friend inline simd_vec3 operator/(simd_vec3 v, T t) {
+			return (1 / t) * v;
+		}
+
+		friend inline T dot(const simd_vec3& u, const simd_vec3& v) {
+			return ops::dot3(u.v, v.v);
+		}
+
+		friend inline simd_vec3 cross(const simd_vec3& u, const simd_vec3& v) {
+			// u x v = u.yzx * v.zxy - u.zxy * v.yzx, computed as (u * v.yzx - u.yzx * v).yzx
+			auto r = ops::sub(ops::mul(u.v, ops::yzx(v.v)), ops::mul(ops::yzx(u.v), v.v));
+			return simd_vec3(ops::yzx(r));
+		}
+
+		friend inline simd_vec3 unit_vector(simd_vec3 v) {
+			return v / v.length();
+		}
+
+	public:
+		union {
+			reg v;
+			T e[4];
+		};
+};
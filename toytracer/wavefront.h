@@ -0,0 +1,79 @@
+#pragma once
+
+#include "toytracer.h"
+
+#include "hittable.h"
+#include "material.h"
+
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// State of one path in flight in the wavefront integrator
+struct path_state {
+	ray r;
+	color throughput;
+	color radiance;
+	hit_result result;
+	sampler s; // Each path carries its own sampler, so the image matches tracing paths one at a time
+	bool hit;
+};
+
+// Buffers a thread reuses for every wavefront it traces
+struct wavefront_buffers {
+	std::vector<path_state> paths;
+	std::vector<uint32_t> active; // Paths still being traced, in pixel order
+	std::vector<uint32_t> next_active;
+	std::vector<uint32_t> shade_queues[material_kind_count]; // Hit paths binned by material kind
+};
+
+// What happened to the paths entering one bounce
+struct bounce_stats {
+	uint64_t paths = 0;
+	uint64_t misses = 0;     // Escaped to the sky
+	uint64_t absorbed = 0;   // Material returned no scattered ray
+	uint64_t terminated = 0; // Ended by Russian roulette
+	uint64_t shaded[material_kind_count] = {};
+};
+
+// Per-bounce counters. Threads count into their own copy and merge it into a shared one.
+class wavefront_stats {
+	public:
+		wavefront_stats(int max_depth) : bounces(max_depth) {}
+
+		bounce_stats& operator[](int depth) { return bounces[depth]; }
+
+		// Adds other's counts to this one and clears other
+		void merge(wavefront_stats& other) {
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t depth = 0; depth < bounces.size(); depth++) {
+				auto& to = bounces[depth];
+				auto& from = other.bounces[depth];
+				to.paths += from.paths;
+				to.misses += from.misses;
+				to.absorbed += from.absorbed;
+				to.terminated += from.terminated;
+				for (int kind = 0; kind < material_kind_count; kind++)
+					to.shaded[kind] += from.shaded[kind];
+				from = bounce_stats();
+			}
+		}
+
+		void report(std::ostream& out) {
+			std::lock_guard<std::mutex> lock(mutex);
+			out << "Bounce     paths    misses  absorbed  roulette   diffuse     metal     other" << std::endl;
+			for (size_t depth = 0; depth < bounces.size() && bounces[depth].paths > 0; depth++) {
+				const auto& b = bounces[depth];
+				out << std::setw(6) << depth << std::setw(10) << b.paths << std::setw(10) << b.misses
+				    << std::setw(10) << b.absorbed << std::setw(10) << b.terminated
+				    << std::setw(10) << b.shaded[int(material_kind::lambertian)]
+				    << std::setw(10) << b.shaded[int(material_kind::metal)]
+				    << std::setw(10) << b.shaded[int(material_kind::other)] << std::endl;
+			}
+		}
+
+	private:
+		std::mutex mutex;
+		std::vector<bounce_stats> bounces;
+};